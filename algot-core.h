@@ -0,0 +1,1026 @@
+/*
+ * ALGOT core: the interval DP over one calculation window and the pick
+ *  that walks its solution.  Nothing here knows about locking, queues or
+ *  the block layer beyond struct request, blk_rq_pos() and its ioprio,
+ *  so the same code is built into the scheduler and into the userspace
+ *  replay in tools/, which supplies those and the few kernel primitives
+ *  used here in tools/kernel-compat.h.
+ *
+ * A plan is filled in three steps: sorted[] is laid out in c-scan order,
+ *  by member depth after algot_stripe_order() on a stripe, with
+ *  algot_link() remembering where each request sat in the previous
+ *  plan, algot_lay_out() picks the cell width and fills the position
+ *  arrays with the seek costs of the plan's model, algot_solve() fills
+ *  the matrix.  algot_trim() and algot_side() then serve it from both
+ *  ends, or algot_satf() by access time under a rotation model.  A greedy
+ *  plan skips the matrix and algot_side() takes the nearer end.
+ */
+#ifndef _ALGOT_CORE_H
+#define _ALGOT_CORE_H
+
+/* Special values for algot_plan.sorted */
+#define ALGOT_REF_MERGED     ((struct request*)0x0)
+#define ALGOT_REF_DISPATCHED ((struct request*)0x1)
+
+/* Smallest window worth saving the FPU state for the vectorised sweep */
+#define ALGOT_SIMD_MIN  32
+
+/* Fewest filled cells that time the sweep rather than its setup */
+#define ALGOT_TIMED_CELLS  4096
+
+/* Special value for algot_plan.prev_idx, request was not in the last plan */
+#define ALGOT_IDX_NEW  UINT_MAX
+
+/*
+ * Most one request costs to transfer and weighs, whatever its size, which
+ *  keeps the bound algot_lay_out() checks cells against within reach
+ */
+#define ALGOT_RQ_XFER_MAX    U32_MAX
+#define ALGOT_RQ_WEIGHT_MAX  1024
+
+/* Most points of a seek model, and the fixed point of its slopes */
+#define ALGOT_MODEL_POINTS  16
+#define ALGOT_SLOPE_SHIFT   32
+
+/*
+ * What a seek over a distance costs, as a piecewise linear function
+ *  through n points of increasing distance and non-decreasing cost, in
+ *  whatever unit the device was calibrated in.  Distances up to the first
+ *  point cost the first point, past the last one the last segment goes
+ *  on, up to far, beyond which the cost saturates at U64_MAX.  n == 0 is
+ *  the raw sector distance.
+ */
+struct algot_model {
+    unsigned int n;                         // number of points
+    sector_t dist[ALGOT_MODEL_POINTS];      // distance in sectors
+    sector_t cost[ALGOT_MODEL_POINTS];      // cost of seeking that far
+    u64 slope[ALGOT_MODEL_POINTS];          // of the segment ending at i
+    sector_t far;                           // farthest costed within u64
+};
+
+/* Most zones of a rotation model */
+#define ALGOT_ZONES  16
+
+/*
+ * Where sectors sit on the platter, for costing the rotational wait on
+ *  top of the seek.  Zone z starts at start[z] with spt[z] sectors per
+ *  track, starts ascend and the first is 0.  Angles are in the cost unit
+ *  of a revolution, rev, which makes sense when the seek model is in
+ *  time too.  nz == 0 leaves rotation out.
+ */
+struct algot_rotation {
+    unsigned int nz;                // number of zones
+    u32 rev;                        // cost of one revolution
+    sector_t start[ALGOT_ZONES];    // first sector of the zone
+    u32 spt[ALGOT_ZONES];           // sectors per track in the zone
+};
+
+/*
+ * How a striped volume lays sectors out over its members: chunks of chunk
+ *  sectors go round width data members, a row of them at the same depth
+ *  of each.  width == 0 leaves sectors where they are, on one disk.
+ */
+struct algot_stripe {
+    unsigned int chunk;     // sectors per chunk
+    unsigned int width;     // data members a row spans
+};
+
+/*
+ * Think times fall in slots of powers of two us, the last takes the rest.
+ *  A history is halved when it reaches ALGOT_THINK_SAMPLES and counts from
+ *  ALGOT_THINK_MIN on.
+ */
+#define ALGOT_THINK_SLOTS    16
+#define ALGOT_THINK_SAMPLES  64
+#define ALGOT_THINK_MIN      8
+
+/* Farthest from where the last read ended the next one reads on, in sectors */
+#define ALGOT_STREAM_GAP  128
+
+/* How the synchronous reads of one submitter follow each other */
+struct algot_stream {
+    sector_t last_end;      // where its last read ended
+    unsigned int queued;    // reads of it in the scheduler
+    unsigned int seq;       // share of reads near last_end, in 1/256
+    unsigned int samples;   // think times in think[]
+    u16 think[ALGOT_THINK_SLOTS];   // by log2 of us
+};
+
+/* One solution over the calculation window */
+struct algot_plan {
+    struct request **sorted;// reference array sorted in c-scan order
+    unsigned int *prev_idx; // index of sorted[i] in the previous plan
+    unsigned int *chain;    // number of unchanged requests right before i
+    void *pos;              // sector of sorted[i], cell width of the plan
+    void *adj;              // seek cost from sorted[i] to sorted[i+1]
+    void *xfer;             // transfer cost of sorted[i]
+    u32 *wsum;              // weight of sorted[0..i-1], ns+1 entries
+    sector_t base;          // sector pos[] is relative to
+    void *cost_matrix;      // algot computation matrix
+    struct algot_model model;   // seek costs of the plan
+    struct algot_rotation rot;  // rotational costs of the plan
+    struct algot_stripe stripe; // member layout the plan is ordered in
+    unsigned int xfer_cost; // cost of transferring 1 MiB, 0 for none
+    unsigned int size_weight;   // sectors per extra unit of weight, 0 for none
+    unsigned int rt_weight; // weight factor of real-time requests
+    u32 *ang;               // angle of sorted[i] under rot
+    unsigned int ns;        // table width
+    int dir;                // data direction of the requests in sorted
+    bool vloc;              // vmalloc flag for cost_matrix
+    bool narrow;            // cost_matrix cells are u32
+    bool greedy;            // no matrix, nearer end first
+};
+
+/*
+ * Check the n points in m and work out their slopes.  Returns false when
+ *  they do not make a model, m->n is left 0 then.
+ */
+static inline bool algot_model_set(struct algot_model *m, unsigned int n)
+{
+    unsigned int i;
+    u64 room;
+
+    m->n = 0;
+    if (n == 1 || n > ALGOT_MODEL_POINTS)
+        return false;
+    for (i = 0; i < n; i++)
+    {
+        if (m->cost[i] > U32_MAX)
+            return false;   // keeps the slopes and the extrapolation sane
+        if (i && (m->dist[i] <= m->dist[i-1] || m->cost[i] < m->cost[i-1]))
+            return false;
+        if (i)
+            m->slope[i] = div64_u64((m->cost[i] - m->cost[i-1]) << ALGOT_SLOPE_SHIFT,
+                                    m->dist[i] - m->dist[i-1]);
+    }
+    m->slope[0] = 0;
+    m->n = n;
+
+    /*
+     * Extrapolating over span adds span*slope >> ALGOT_SLOPE_SHIFT, which
+     *  stays within room as long as span is under room/slope whole units
+     */
+    m->far = U64_MAX;
+    if (n && m->slope[n-1])
+    {
+        room = div64_u64(U64_MAX - m->cost[n-2], m->slope[n-1]);
+        if (room >> (64 - ALGOT_SLOPE_SHIFT) == 0 &&
+            (room << ALGOT_SLOPE_SHIFT) < U64_MAX - m->dist[n-2])
+            m->far = m->dist[n-2] + (room << ALGOT_SLOPE_SHIFT);
+    }
+    return true;
+}
+
+static inline bool
+algot_model_equal(const struct algot_model *a, const struct algot_model *b)
+{
+    return a->n == b->n &&
+           !memcmp(a->dist, b->dist, a->n*sizeof(a->dist[0])) &&
+           !memcmp(a->cost, b->cost, a->n*sizeof(a->cost[0]));
+}
+
+/* Check a rotation model, r->nz is left 0 when it is not one */
+static inline bool algot_rotation_set(struct algot_rotation *r, unsigned int nz)
+{
+    unsigned int z;
+
+    r->nz = 0;
+    if (nz > ALGOT_ZONES || (nz && (!r->rev || r->start[0])))
+        return false;
+    for (z = 0; z < nz; z++)
+    {
+        if (!r->spt[z] || (z && r->start[z] <= r->start[z-1]))
+            return false;
+    }
+    r->nz = nz;
+    return true;
+}
+
+static inline bool
+algot_rotation_equal(const struct algot_rotation *a, const struct algot_rotation *b)
+{
+    return a->nz == b->nz && (!a->nz || a->rev == b->rev) &&
+           !memcmp(a->start, b->start, a->nz*sizeof(a->start[0])) &&
+           !memcmp(a->spt, b->spt, a->nz*sizeof(a->spt[0]));
+}
+
+static inline sector_t algot_dist(sector_t a, sector_t b)
+{
+    return a > b ? a-b : b-a;
+}
+
+/*
+ * Depth of sector s on whichever member of st holds it, where one head
+ *  stands for the heads of them all: a row is as near to itself as to
+ *  its neighbours on the other members.
+ */
+static inline sector_t
+algot_member_pos(const struct algot_stripe *st, sector_t s)
+{
+    u32 off;
+
+    if (!st->width)
+        return s;
+    s = div_u64_rem(s, st->chunk, &off);
+    return div_u64(s, st->width) * st->chunk + off;
+}
+
+/* Where rq starts in the space plan p is costed in */
+static inline sector_t algot_pos(const struct algot_plan *p, struct request *rq)
+{
+    return algot_member_pos(&p->stripe, blk_rq_pos(rq));
+}
+
+/* The stripe and the depth of the head algot_stripe_cmp() orders by */
+struct algot_stripe_scan {
+    const struct algot_stripe *st;
+    sector_t head;
+};
+
+/*
+ * C-scan by depth: what lies past the head before what does not, each
+ *  from the least deep on, a row by sector.
+ */
+static inline int
+algot_stripe_cmp(const void *a, const void *b, const void *priv)
+{
+    const struct algot_stripe_scan *sc = priv;
+    sector_t pa = blk_rq_pos(*(struct request * const *)a);
+    sector_t pb = blk_rq_pos(*(struct request * const *)b);
+    sector_t da = algot_member_pos(sc->st, pa);
+    sector_t db = algot_member_pos(sc->st, pb);
+    bool ba = da <= sc->head, bb = db <= sc->head;
+
+    if (ba != bb)
+        return ba ? 1 : -1;
+    if (da != db)
+        return da < db ? -1 : 1;
+    return pa < pb ? -1 : pa > pb;
+}
+
+/*
+ * Put sorted[0..ns-1] of p in c-scan order by depth on the members of its
+ *  stripe, from head, a sector, before they are linked.  Off a stripe
+ *  they stay as they are.
+ */
+static inline void algot_stripe_order(struct algot_plan *p, sector_t head)
+{
+    struct algot_stripe_scan sc = {
+        .st = &p->stripe,
+        .head = algot_member_pos(&p->stripe, head),
+    };
+
+    if (p->stripe.width && p->ns > 1)
+        sort_r(p->sorted, p->ns, sizeof(p->sorted[0]), algot_stripe_cmp,
+               NULL, &sc);
+}
+
+/* Angle of sector s, in [0, rev) */
+static inline u32 algot_angle(const struct algot_rotation *r, sector_t s)
+{
+    unsigned int z = r->nz - 1;
+    u32 off;
+
+    while (z && s < r->start[z])
+        z--;
+    div_u64_rem(s - r->start[z], r->spt[z], &off);
+    return div_u64((u64)off * r->rev, r->spt[z]);
+}
+
+/* Wait for angle to under the head, after seeking away from angle from */
+static __always_inline sector_t
+algot_rot_wait(const struct algot_rotation *r, u32 from, u32 to, sector_t seek)
+{
+    u32 at;
+
+    div_u64_rem(from + seek, r->rev, &at);
+    return to >= at ? to - at : (sector_t)to + r->rev - at;
+}
+
+/* What transferring the given number of sectors costs in plan p */
+static inline sector_t
+algot_xfer(const struct algot_plan *p, unsigned int sectors)
+{
+    u64 cost = div_u64((u64)sectors * p->xfer_cost, 2048);
+
+    return cost < ALGOT_RQ_XFER_MAX ? cost : ALGOT_RQ_XFER_MAX;
+}
+
+/*
+ * How much the wait of a request counts, 1 and one more per size_weight,
+ *  times rt_weight for a real-time one
+ */
+static inline u32 algot_weight(const struct algot_plan *p, struct request *rq)
+{
+    u32 w = p->size_weight ? blk_rq_sectors(rq) / p->size_weight : 0;
+
+    w = w < ALGOT_RQ_WEIGHT_MAX ? w + 1 : ALGOT_RQ_WEIGHT_MAX;
+
+    if (IOPRIO_PRIO_CLASS(req_get_ioprio(rq)) == IOPRIO_CLASS_RT)
+        w = (u64)w * p->rt_weight < ALGOT_RQ_WEIGHT_MAX ?
+            w * p->rt_weight : ALGOT_RQ_WEIGHT_MAX;
+    return w;
+}
+
+/* a + b, saturating at U64_MAX */
+static inline u64 algot_add_sat(u64 a, u64 b)
+{
+    return a < U64_MAX - b ? a + b : U64_MAX;
+}
+
+/* Weight of the requests in sorted[i..j], i <= j */
+static __always_inline sector_t
+algot_wsum(const struct algot_plan *p, unsigned int i, unsigned int j)
+{
+    return p->wsum[j+1] - p->wsum[i];
+}
+
+/* Cost of a seek over d sectors */
+static __always_inline sector_t
+algot_seek_cost(const struct algot_model *m, sector_t d)
+{
+    unsigned int i;
+
+    if (!m->n)
+        return d;
+    if (!d)
+        return 0;
+    if (d <= m->dist[0])
+        return m->cost[0];
+    if (d > m->far)
+        return U64_MAX;
+    for (i = 1; i+1 < m->n && d > m->dist[i]; i++)
+        ;
+    return m->cost[i-1] +
+           mul_u64_u64_shr(d - m->dist[i-1], m->slope[i], ALGOT_SLOPE_SHIFT);
+}
+
+/*
+ * The matrix is stored diagonal by diagonal: the cells of intervals with
+ *  j-i == k are consecutive, in the order algot_sweep() fills them.
+ *  The first half holds MATRIX(i, i+k) (head at the left end of the
+ *  interval), the second half MATRIX(i+k, i) (head at the right end).
+ *  The k == 0 diagonal is all zero and not stored, so a table of width ns
+ *  takes ns*(ns-1) cells, packed at the start of the buffer.
+ */
+static inline unsigned long mx_half(unsigned int ns)
+{
+    return (unsigned long)ns*(ns-1)/2;
+}
+
+static inline unsigned long mx_diag(unsigned int ns, unsigned int k)
+{
+    return (unsigned long)(k-1)*ns - (unsigned long)(k-1)*k/2;
+}
+
+/* Narrow matrices keep their cells in u32 instead of sector_t */
+static __always_inline sector_t
+mx_get(const void *mx, bool narrow, unsigned long idx)
+{
+    return narrow ? ((const u32*)mx)[idx] : ((const sector_t*)mx)[idx];
+}
+
+static __always_inline void
+mx_set(void *mx, bool narrow, unsigned long idx, sector_t val)
+{
+    if (narrow)
+        ((u32*)mx)[idx] = val;
+    else
+        ((sector_t*)mx)[idx] = val;
+}
+
+static inline void
+mx_copy(void *dst, bool dn, unsigned long di,
+        const void *src, bool sn, unsigned long si, unsigned long n)
+{
+    if (dn == sn)
+    {
+        size_t cell = dn ? sizeof(u32) : sizeof(sector_t);
+        memcpy(dst + di*cell, src + si*cell, n*cell);
+        return;
+    }
+    while (n--)
+        mx_set(dst, dn, di++, mx_get(src, sn, si++));
+}
+
+/* MATRIX(i, j) of plan p, i != j */
+static inline sector_t
+algot_cost(const struct algot_plan *p, unsigned int i, unsigned int j)
+{
+    if (i < j)
+        return mx_get(p->cost_matrix, p->narrow, mx_diag(p->ns, j-i) + i);
+    return mx_get(p->cost_matrix, p->narrow, mx_half(p->ns) + mx_diag(p->ns, i-j) + j);
+}
+
+static inline void algot_chain(struct algot_plan *p, unsigned int idx)
+{
+    unsigned int prev = p->prev_idx[idx];
+
+    if (idx == 0 || prev == ALGOT_IDX_NEW ||
+        p->prev_idx[idx-1] == ALGOT_IDX_NEW ||
+        prev != p->prev_idx[idx-1]+1)
+        p->chain[idx] = 0;
+    else
+        p->chain[idx] = p->chain[idx-1]+1;
+}
+
+/* Put req at idx of p, prev is its index in the last plan or ALGOT_IDX_NEW */
+static inline void
+algot_link(struct algot_plan *p, unsigned int idx, struct request *req,
+           unsigned int prev)
+{
+    p->prev_idx[idx] = prev;
+    algot_chain(p, idx);
+    p->sorted[idx] = req;
+}
+
+/*
+ * Forget where the requests a merge moved or grew since old sat in it,
+ *  every interval holding one has to be recalculated.  Only reads the
+ *  arrays of both plans, p has to be laid out.
+ */
+static inline void
+algot_revalidate(struct algot_plan *p, const struct algot_plan *old)
+{
+    unsigned int i, prev;
+    bool changed = false;
+
+    for (i = 0; i < p->ns; i++)
+    {
+        prev = p->prev_idx[i];
+        if (prev == ALGOT_IDX_NEW)
+            continue;
+        if (mx_get(old->pos, old->narrow, prev) + old->base !=
+            mx_get(p->pos, p->narrow, i) + p->base ||
+            mx_get(old->xfer, old->narrow, prev) != mx_get(p->xfer, p->narrow, i) ||
+            algot_wsum(old, prev, prev) != algot_wsum(p, i, i))
+        {
+            p->prev_idx[i] = ALGOT_IDX_NEW;
+            changed = true;
+        }
+    }
+    if (!changed)
+        return;
+    for (i = 0; i < p->ns; i++)
+        algot_chain(p, i);
+}
+
+/*
+ * Copy the intervals that did not change since the last plan.  Interval
+ *  [i,j] is unchanged when chain[j] >= j-i, i.e. when it lies inside one
+ *  run [a,b] of requests still adjacent in the last order.  For each run,
+ *  diagonal k holds cells a..b-k, contiguous in the new and old matrix.
+ *  Returns the number of cells copied.
+ */
+static inline unsigned long
+algot_reuse(struct algot_plan *w, const struct algot_plan *old)
+{
+    unsigned int ns = w->ns, pns = old->ns;
+    bool narrow = w->narrow;
+    unsigned int *pi = w->prev_idx;
+    unsigned int *ch = w->chain;
+    unsigned long half = mx_half(ns), phalf = mx_half(pns);
+    unsigned long copied = 0;
+    unsigned int a, b, k;
+
+    for (b = 1; b < ns; b++)
+    {
+        if (ch[b] == 0 || (b+1 < ns && ch[b+1]))
+            continue;
+        a = b - ch[b];
+        for (k = 1; k <= b-a; k++)
+        {
+            mx_copy(w->cost_matrix, narrow, mx_diag(ns, k) + a,
+                    old->cost_matrix, old->narrow, mx_diag(pns, k) + pi[a],
+                    b-a-k+1);
+            mx_copy(w->cost_matrix, narrow, half + mx_diag(ns, k) + a,
+                    old->cost_matrix, old->narrow, phalf + mx_diag(pns, k) + pi[a],
+                    b-a-k+1);
+            copied += 2*(b-a-k+1);
+        }
+    }
+    return copied;
+}
+
+static __always_inline sector_t
+mx_dist(const void *pos, bool narrow, unsigned int i, unsigned int j)
+{
+    sector_t a = mx_get(pos, narrow, i);
+    sector_t b = mx_get(pos, narrow, j);
+
+    return a > b ? a-b : b-a;
+}
+
+/*
+ * Cells i0..i1-1 of diagonal k >= 2, reading diagonal k-1.  Each move is
+ *  waited for by the k requests left, or their weight, for the seek and
+ *  for the transfer of the request it goes to.
+ */
+static __always_inline void
+algot_diag(struct algot_plan *w, unsigned int k,
+           unsigned int i0, unsigned int i1, const bool narrow)
+{
+    void *mx = w->cost_matrix;
+    unsigned int ns = w->ns;
+    unsigned long half = mx_half(ns);
+    unsigned long cur = mx_diag(ns, k);
+    unsigned long prev = mx_diag(ns, k-1);
+    void *x = w->xfer;
+    sector_t span, wf, wb, cl, cr;
+    unsigned int i;
+
+    for (i = i0; i < i1; i++)
+    {
+        span = algot_seek_cost(&w->model, mx_dist(w->pos, narrow, i, i+k));
+        wf = algot_wsum(w, i+1, i+k);
+        wb = algot_wsum(w, i, i+k-1);
+
+        cl = wf*(mx_get(w->adj, narrow, i) + mx_get(x, narrow, i+1)) +
+             mx_get(mx, narrow, prev+i+1);
+        cr = wf*(span + mx_get(x, narrow, i+k)) + mx_get(mx, narrow, half+prev+i+1);
+        mx_set(mx, narrow, cur+i, min(cl, cr));
+
+        cl = wb*(mx_get(w->adj, narrow, i+k-1) + mx_get(x, narrow, i+k-1)) +
+             mx_get(mx, narrow, half+prev+i);
+        cr = wb*(span + mx_get(x, narrow, i)) + mx_get(mx, narrow, prev+i);
+        mx_set(mx, narrow, half+cur+i, min(cl, cr));
+    }
+}
+
+#ifdef CONFIG_X86_64
+static bool algot_has_avx2 __read_mostly;
+
+static inline bool algot_use_simd(unsigned int ns)
+{
+    return algot_has_avx2 && ns >= ALGOT_SIMD_MIN && may_use_simd();
+}
+
+static inline void algot_simd_begin(void)
+{
+    kernel_fpu_begin();
+}
+
+static inline void algot_simd_end(void)
+{
+    kernel_fpu_end();
+}
+
+/*
+ * algot_diag() on a narrow matrix under the raw distance model, 8 cells
+ *  per iteration.  No candidate cost can exceed the bound checked in
+ *  algot_lay_out(), so 32-bit lanes never overflow.  Caller holds
+ *  kernel_fpu_begin().
+ */
+static void
+algot_diag_avx2(struct algot_plan *w, unsigned int k,
+                unsigned int i0, unsigned int i1)
+{
+    u32 *mx = w->cost_matrix;
+    u32 *pos = w->pos;
+    u32 *adj = w->adj;
+    u32 *x = w->xfer;
+    u32 *ws = w->wsum;
+    unsigned int ns = w->ns;
+    unsigned long half = mx_half(ns);
+    u32 *f = mx + mx_diag(ns, k), *fp = mx + mx_diag(ns, k-1);
+    u32 *b = f + half, *bp = fp + half;
+    unsigned int i;
+
+    for (i = i0; i+8 <= i1; i += 8)
+    {
+        /* One register per array, element i+k is at (base,k4) */
+        asm volatile(
+            "vmovdqu 4(%[ws],%[k4]), %%ymm7\n\t"
+            "vpsubd 4(%[ws]), %%ymm7, %%ymm7\n\t"       // weight of i+1..i+k
+            "vmovdqu (%[ws],%[k4]), %%ymm8\n\t"
+            "vpsubd (%[ws]), %%ymm8, %%ymm8\n\t"        // weight of i..i+k-1
+            "vmovdqu (%[pos]), %%ymm0\n\t"
+            "vmovdqu (%[pos],%[k4]), %%ymm1\n\t"
+            "vpmaxud %%ymm1, %%ymm0, %%ymm2\n\t"
+            "vpminud %%ymm1, %%ymm0, %%ymm0\n\t"
+            "vpsubd %%ymm0, %%ymm2, %%ymm2\n\t"         // span
+            "vpaddd (%[x],%[k4]), %%ymm2, %%ymm6\n\t"
+            "vpmulld %%ymm7, %%ymm6, %%ymm6\n\t"
+            "vpaddd (%[x]), %%ymm2, %%ymm2\n\t"
+            "vpmulld %%ymm8, %%ymm2, %%ymm2\n\t"
+            "vmovdqu (%[adj]), %%ymm3\n\t"
+            "vpaddd 4(%[x]), %%ymm3, %%ymm3\n\t"
+            "vpmulld %%ymm7, %%ymm3, %%ymm3\n\t"
+            "vpaddd 4(%[fp]), %%ymm3, %%ymm3\n\t"
+            "vpaddd 4(%[bp]), %%ymm6, %%ymm4\n\t"
+            "vpminud %%ymm4, %%ymm3, %%ymm3\n\t"
+            "vmovdqu %%ymm3, (%[f])\n\t"
+            "vmovdqu -4(%[adj],%[k4]), %%ymm5\n\t"
+            "vpaddd -4(%[x],%[k4]), %%ymm5, %%ymm5\n\t"
+            "vpmulld %%ymm8, %%ymm5, %%ymm5\n\t"
+            "vpaddd (%[bp]), %%ymm5, %%ymm5\n\t"
+            "vpaddd (%[fp]), %%ymm2, %%ymm4\n\t"
+            "vpminud %%ymm4, %%ymm5, %%ymm5\n\t"
+            "vmovdqu %%ymm5, (%[b])\n\t"
+            :
+            : [k4] "r" ((unsigned long)k*4),
+              [ws] "r" (ws+i), [pos] "r" (pos+i), [adj] "r" (adj+i),
+              [x] "r" (x+i), [fp] "r" (fp+i), [bp] "r" (bp+i),
+              [f] "r" (f+i), [b] "r" (b+i)
+            : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
+              "xmm8", "memory");
+    }
+    algot_diag(w, k, i, i1, true);
+}
+#else
+static inline bool algot_use_simd(unsigned int ns)
+{
+    return false;
+}
+
+static inline void algot_simd_begin(void)
+{
+}
+
+static inline void algot_simd_end(void)
+{
+}
+
+static inline void
+algot_diag_avx2(struct algot_plan *w, unsigned int k,
+                unsigned int i0, unsigned int i1)
+{
+    algot_diag(w, k, i0, i1, true);
+}
+#endif
+
+/*
+ * Fill every cell of the new matrix not copied by algot_reuse(), one
+ *  diagonal at a time, in runs of consecutive cells.
+ */
+static __always_inline void
+algot_sweep(struct algot_plan *w, const bool narrow, bool simd)
+{
+    void *mx = w->cost_matrix;
+    unsigned int ns = w->ns;
+    unsigned int *ch = w->chain;
+    unsigned long half = mx_half(ns);
+    unsigned int i, e, k;
+
+    /* Intervals of 2: the seek in between and the transfer at the other end */
+    for (i = 0; i+1 < ns; i++)
+    {
+        if (ch[i+1] >= 1)
+            continue;
+        mx_set(mx, narrow, i, algot_wsum(w, i+1, i+1) *
+               (mx_get(w->adj, narrow, i) + mx_get(w->xfer, narrow, i+1)));
+        mx_set(mx, narrow, half+i, algot_wsum(w, i, i) *
+               (mx_get(w->adj, narrow, i) + mx_get(w->xfer, narrow, i)));
+    }
+
+    for (k = 2; k < ns; k++)
+    {
+        for (i = 0; i < ns-k; i = e)
+        {
+            while (i < ns-k && ch[i+k] >= k)
+                i++;    // copied by algot_reuse()
+            for (e = i; e < ns-k && ch[e+k] < k; e++)
+                ;
+            if (e == i)
+                continue;
+            if (narrow && simd)
+                algot_diag_avx2(w, k, i, e);
+            else
+                algot_diag(w, k, i, e, narrow);
+        }
+    }
+}
+
+/*
+ * Choose the cell width of p and fill its position arrays, once
+ *  sorted[0..ns-1] is laid out and the cost parameters of p set.  Costs
+ *  grow with the distance, so no move costs more than seeking the whole
+ *  span and transferring the largest request, nor any cell more than that
+ *  times the heaviest weight times (1+2+..+(ns-1)); when that fits, and
+ *  the span fits the positions, the cells are kept in 32 bits, positions
+ *  relative to the lowest sector, and the sweep touches half the memory.
+ *  When not even 64 bits hold it, on a huge disk or with a steep seek
+ *  model, the plan goes without a matrix.  The bound is checked by
+ *  division, a product of wide costs would wrap.  Cells algot_reuse()
+ *  takes over from a wide plan hold intervals of the same requests at
+ *  the same positions, which the bound covers as well.  On a stripe the
+ *  positions are depths on the members.  Under a rotation model there
+ *  is no matrix, only the angles.
+ */
+static inline void algot_lay_out(struct algot_plan *p, bool allow_narrow)
+{
+    unsigned int i, ns = p->ns, big = 0;
+    sector_t lo = 0, hi = 0, base = 0, sect, move;
+    u32 w, heavy = 1;
+    bool narrow = false;
+
+    p->wsum[0] = 0;
+    for (i = 0; i < ns; i++)
+    {
+        if (blk_rq_sectors(p->sorted[i]) > big)
+            big = blk_rq_sectors(p->sorted[i]);
+        w = algot_weight(p, p->sorted[i]);
+        if (w > heavy)
+            heavy = w;
+        p->wsum[i+1] = p->wsum[i] + w;
+    }
+
+    if (ns > 1)
+    {
+        lo = hi = algot_pos(p, p->sorted[0]);
+        for (i = 1; i < ns; i++)
+        {
+            sect = algot_pos(p, p->sorted[i]);
+            lo = sect < lo ? sect : lo;
+            hi = sect > hi ? sect : hi;
+        }
+        move = algot_add_sat(algot_seek_cost(&p->model, hi - lo),
+                             algot_xfer(p, big));
+        narrow = allow_narrow && hi - lo <= U32_MAX &&
+                 move <= U32_MAX / mx_half(ns) / heavy;
+        if (narrow)
+            base = lo;
+        if (move > U64_MAX / mx_half(ns) / heavy)
+            p->greedy = true;
+    }
+    p->narrow = narrow;
+    p->base = base;
+
+    for (i = 0; i < ns; i++)
+    {
+        mx_set(p->pos, narrow, i, algot_pos(p, p->sorted[i]) - base);
+        mx_set(p->xfer, narrow, i, algot_xfer(p, blk_rq_sectors(p->sorted[i])));
+    }
+    for (i = 0; i+1 < ns; i++)
+        mx_set(p->adj, narrow, i,
+               algot_seek_cost(&p->model, mx_dist(p->pos, narrow, i, i+1)));
+
+    if (p->rot.nz)
+    {
+        for (i = 0; i < ns; i++)
+            p->ang[i] = algot_angle(&p->rot, blk_rq_pos(p->sorted[i]));
+    }
+}
+
+/*
+ * Fill the matrix of p, copying what is still valid from old, the plan
+ *  its prev_idx[] refers to.  chain[] is all zero when p was laid out
+ *  without reuse.  Nothing is valid when old was costed with other
+ *  models or had no matrix.  A plan under a rotation model is served by
+ *  algot_satf() and has no matrix, neither has a greedy one.  Returns the
+ *  number of cells filled.
+ */
+static inline unsigned long
+algot_solve(struct algot_plan *p, const struct algot_plan *old)
+{
+    unsigned long cells = 2*mx_half(p->ns);
+    bool simd;
+
+    if (p->rot.nz || p->greedy)
+        return 0;
+
+    if (!old->greedy && algot_model_equal(&p->model, &old->model) &&
+        algot_rotation_equal(&p->rot, &old->rot) &&
+        p->stripe.chunk == old->stripe.chunk &&
+        p->stripe.width == old->stripe.width &&
+        p->xfer_cost == old->xfer_cost && p->size_weight == old->size_weight &&
+        p->rt_weight == old->rt_weight)
+    {
+        algot_revalidate(p, old);
+        cells -= algot_reuse(p, old);
+    }
+    else
+        memset(p->chain, 0, p->ns*sizeof(p->chain[0]));
+
+    simd = p->narrow && !p->model.n && algot_use_simd(p->ns);
+    if (simd)
+        algot_simd_begin();
+    if (p->narrow)
+        algot_sweep(p, true, simd);
+    else
+        algot_sweep(p, false, false);
+    if (simd)
+        algot_simd_end();
+    return cells;
+}
+
+/*
+ * Average cost of a cell, avg, in 1/256 ns, after algot_solve() took spent
+ *  ns to fill cells of them.  A few cells say more about the setup than
+ *  about the sweep and are left out.
+ */
+static inline u32 algot_cell_cost(u32 avg, unsigned long cells, u64 spent)
+{
+    u64 cell;
+
+    if (cells < ALGOT_TIMED_CELLS)
+        return avg;
+    cell = div64_u64(spent << 8, cells);
+    if (cell > U32_MAX)
+        cell = U32_MAX;
+    return avg - avg/8 + cell/8;
+}
+
+/* Widest plan whose whole matrix fills in about budget ns at avg a cell */
+static inline unsigned int algot_budget_width(u64 budget, u32 avg)
+{
+    return int_sqrt64(div64_u64(budget << 8, avg ? avg : 1));
+}
+
+/*
+ * Skip the tombstones at both ends of the live interval [*s, *e] of p.
+ *  Returns false once nothing is left in it.
+ */
+static inline bool
+algot_trim(const struct algot_plan *p, unsigned int *s, unsigned int *e)
+{
+    struct request **sorted = p->sorted;
+
+    while (*s <= *e && sorted[*s] == ALGOT_REF_MERGED)
+        (*s)++;
+    if (*s > *e)
+        return false;
+    while (sorted[*e] == ALGOT_REF_MERGED)
+        (*e)--;
+    return true;
+}
+
+/* Cost of the seek from head, a sector, to sorted[i] */
+static inline sector_t
+algot_reach(const struct algot_plan *p, unsigned int i, sector_t head)
+{
+    return algot_seek_cost(&p->model,
+                           algot_dist(algot_member_pos(&p->stripe, head),
+                                      algot_pos(p, p->sorted[i])));
+}
+
+/*
+ * What serving the start of the trimmed interval [s, e] first, or its end
+ *  unless left, costs with the head at head: the first seek and transfer
+ *  are waited for by all e-s+1 requests, weighed as in the matrix, which
+ *  has the rest.  A greedy plan goes by the first move alone.  The head
+ *  may lie far outside the window, so the sum saturates rather than wrap.
+ */
+static inline sector_t
+algot_first(const struct algot_plan *p, unsigned int s, unsigned int e,
+            sector_t head, bool left)
+{
+    unsigned int i = left ? s : e;
+    sector_t w = algot_wsum(p, s, e), move, val;
+
+    move = algot_add_sat(algot_reach(p, i, head),
+                         algot_xfer(p, blk_rq_sectors(p->sorted[i])));
+    val = move <= U64_MAX / w ? w * move : U64_MAX;
+    if (!p->greedy && s != e)
+        val = algot_add_sat(val, left ? algot_cost(p, s, e) : algot_cost(p, e, s));
+    return val;
+}
+
+/*
+ * Whether serving the start of the trimmed interval [s, e], s != e, costs
+ *  no more than serving its end with the head at head.
+ */
+static inline bool
+algot_side(const struct algot_plan *p, unsigned int s, unsigned int e,
+           sector_t head)
+{
+    return algot_first(p, s, e, head, true) <= algot_first(p, s, e, head, false);
+}
+
+/*
+ * What calculating p bought over going on with old, of which [s, e] is
+ *  live, with the head at head: the cost in p of going where old went
+ *  next, over that of the best first move of p, into *saved.  All ones
+ *  when that is not even an end of p.  False when either plan has
+ *  nothing live or is served by access time, there is nothing to compare.
+ */
+static inline bool
+algot_saving(const struct algot_plan *old, unsigned int s, unsigned int e,
+             const struct algot_plan *p, sector_t head, sector_t *saved)
+{
+    unsigned int ps = 0, pe = p->ns - 1;
+    sector_t left, right, best;
+    struct request *next;
+
+    if (!p->ns || p->rot.nz || old->rot.nz || s > e || e >= old->ns ||
+        !algot_trim(old, &s, &e) || !algot_trim(p, &ps, &pe))
+        return false;
+
+    next = old->sorted[s == e || algot_side(old, s, e, head) ? s : e];
+    left = algot_first(p, ps, pe, head, true);
+    right = ps == pe ? left : algot_first(p, ps, pe, head, false);
+    best = min(left, right);
+    if (next == p->sorted[ps])
+        *saved = left - best;
+    else if (next == p->sorted[pe])
+        *saved = right - best;
+    else
+        *saved = ~(sector_t)0;
+    return true;
+}
+
+/*
+ * Estimate of how far rq, left out of p with its neighbours sorted[a] and
+ *  sorted[b] on either side, can shift the cost of one first move over
+ *  the trimmed interval [s, e] against the other: its own wait, by up to
+ *  the seek between the two, and what its transfer and the detour to it
+ *  add to the wait of all the others.  The detour is nothing without
+ *  a seek model: on a line, rq lies on the way from a to b.
+ */
+static inline sector_t
+algot_shift(const struct algot_plan *p, unsigned int s, unsigned int e,
+            unsigned int a, unsigned int b, struct request *rq)
+{
+    sector_t pos = blk_rq_pos(rq), lo = blk_rq_pos(p->sorted[a]);
+    sector_t hi = blk_rq_pos(p->sorted[b]);
+    sector_t ends = blk_rq_pos(p->sorted[s]), ende = blk_rq_pos(p->sorted[e]);
+    sector_t span, direct, detour;
+
+    direct = algot_seek_cost(&p->model, algot_dist(lo, hi));
+    detour = algot_seek_cost(&p->model, algot_dist(lo, pos)) +
+             algot_seek_cost(&p->model, algot_dist(pos, hi));
+    detour = detour > direct ? detour - direct : 0;
+    span = algot_seek_cost(&p->model, algot_dist(ends, ende));
+    return algot_weight(p, rq)*span +
+           algot_wsum(p, s, e)*(algot_xfer(p, blk_rq_sectors(rq)) + detour);
+}
+
+/*
+ * Shortest access time first over the trimmed interval [s, e] of a plan
+ *  under a rotation model: the live request that comes under the head
+ *  soonest, seeking from head, where the last request ended, with the
+ *  platter at angle ang, and is done soonest when transfers are costed.
+ *  The interval DP only ever serves one end of the c-scan order, which
+ *  leaves it next to nothing of the rotation to exploit, so this does
+ *  without the matrix.
+ */
+static inline unsigned int
+algot_satf(const struct algot_plan *p, unsigned int s, unsigned int e,
+           sector_t head, u32 ang)
+{
+    sector_t seek, cost, best = ~(sector_t)0;
+    unsigned int i, pick = s;
+
+    for (i = s; i <= e; i++)
+    {
+        if (p->sorted[i] == ALGOT_REF_MERGED)
+            continue;
+        seek = algot_reach(p, i, head);
+        cost = seek + algot_rot_wait(&p->rot, ang, p->ang[i], seek) +
+               algot_xfer(p, blk_rq_sectors(p->sorted[i]));
+        if (cost < best)
+        {
+            best = cost;
+            pick = i;
+        }
+    }
+    return pick;
+}
+
+/*
+ * A read of st at pos arrives, now, after its last one was done: note
+ *  whether it reads on from the last one and how long st thought since
+ *  that completed.  done == 0 leaves the think time out.
+ */
+static inline void algot_stream_read(struct algot_stream *st, sector_t pos,
+                                     unsigned int sectors, u64 done, u64 now)
+{
+    bool near = algot_dist(pos, st->last_end) <= ALGOT_STREAM_GAP;
+    unsigned int i, slot;
+
+    st->seq = st->seq - st->seq/8 + (near ? 256/8 : 0);
+    st->last_end = pos + sectors;
+    st->queued++;
+    if (!done || now < done)
+        return;
+
+    slot = ilog2(div_u64(now - done, NSEC_PER_USEC) | 1);
+    st->think[slot < ALGOT_THINK_SLOTS-1 ? slot : ALGOT_THINK_SLOTS-1]++;
+    if (++st->samples < ALGOT_THINK_SAMPLES)
+        return;
+    st->samples = 0;
+    for (i = 0; i < ALGOT_THINK_SLOTS; i++)
+    {
+        st->think[i] /= 2;
+        st->samples += st->think[i];
+    }
+}
+
+/*
+ * Whether st, with nothing queued, mostly reads on from where it stops,
+ *  and within expire us at least 3 times in 4.  expire == 0 never waits.
+ */
+static inline bool
+algot_stream_on(const struct algot_stream *st, unsigned int expire)
+{
+    unsigned int i, soon = 0;
+
+    if (!expire || st->queued || st->seq < 256*3/4 ||
+        st->samples < ALGOT_THINK_MIN)
+        return false;
+    for (i = 0; i < ALGOT_THINK_SLOTS-1 && (2ULL << i) <= expire; i++)
+        soon += st->think[i];
+    return soon*4 >= st->samples*3;
+}
+
+#endif /* _ALGOT_CORE_H */
@@ -4,9 +4,13 @@
  *
  *                               Team A
  *
- * 2 ways to invoke scheduler algot:
- *  -Append "elevator=algot" to kernel line in grub config file or at boot.
- *  -Write "algot" to /sys/block/sdX/queue/scheduler after boot.
+ * ALGOT is a blk-mq scheduler and has to be built as part of the kernel
+ *  tree, since it uses the block layer private headers: drop this file
+ *  and algot-core.h into block/, add
+ *  "obj-$(CONFIG_MQ_IOSCHED_ALGOT) += algot-iosched.o" to block/Makefile
+ *  and a tristate MQ_IOSCHED_ALGOT that selects BLK_ICQ, which the
+ *  io_context of a read comes from, to block/Kconfig.iosched.  Then
+ *  write "algot" to /sys/block/sdX/queue/scheduler.
  *
  * Comparasion with CFQ on a real machine with platter disk:
  * 
@@ -25,349 +29,3908 @@
  *  decreasing margin gain and exponentially increasing cost into account,
  *  we decide to set an up bound of calculation size.  While the optimal up
  *  bound is subject to many subject factors, we decide to let the default
- *  up bound to be the default maxmium queue size of IO scheduler.  We could
- *  also make the up bound an variable and export it to sysfs for user control.
+ *  up bound to be the default maxmium queue size of IO scheduler.  The up
+ *  bound is exported to sysfs as 'calc_max' for user control.
  *
- * We also have a threshold for dirty flag so we do not recalculate the matrix
- *   until the number of new requests reach threshold.  However, once the matrix
- *   is drain, we will recalculate it on next call of dispatch() with any 
- *   (non-zero) number of pending requests.
+ * Most queues are idle most of the time, so the window starts out with
+ *  room for ALGOT_CALC_MIN requests only.  Once requests have to wait for
+ *  room, resize_work reallocates it for the next power of two above what is
+ *  queued, up to calc_max, and after ALGOT_IDLE_RELEASE without requests it
+ *  shrinks back.  Reallocating happens with the queue quiesced, and so
+ *  does lowering calc_max below the size of the window.
  *
- * We use 1 of elevator_private[3] provided in request:
- *   elevator_private[0]: reference to the location in array 'sorted' where
- *                      pointer to this request resides.  
+ * We also have a threshold for dirty flag so we do not recalculate the
+ *   matrix until the number of new requests reach threshold ('dirty_count'
+ *   in sysfs).  However, once the matrix is drain, we will recalculate it
+ *   on next call of dispatch() with any (non-zero) number of pending
+ *   requests.
+ *
+ * Unless 'adapt_dirty' is cleared in sysfs, the threshold only starts out
+ *   at dirty_count and follows what recalculating buys.  A new plan is
+ *   costed going where the old one went next, against its own best first
+ *   move.  With a seek model in us, the difference has to beat the time
+ *   the calculation took; without one, any difference counts.  A plan
+ *   worth it halves the threshold, down to 1, so trickling requests do
+ *   not wait on a stale plan.  Any other raises it by one, up to calc_max,
+ *   so bursts do not recalculate the same order over and over.
+ *
+ * Most new requests fall between two requests the plan already has, away
+ *   from the head, where they hardly change where it goes first.  Unless
+ *   'plan_gate' is cleared in sysfs, a plan past the threshold is kept as
+ *   long as that holds for all of them.  Each one also adds an estimate of
+ *   how far it can shift the cost of one first move against the other:
+ *   its own wait, by up to the seek between the two, plus what its transfer
+ *   and the detour to it add for everyone else.  The plan is kept while
+ *   that sum stays below the gap between the two moves in the matrix, and
+ *   while the requests left out are fewer than a quarter of the plan.
+ *   Once the head reaches the neighbour of one of them, the plan is
+ *   calculated again.
+ *
+ * sort_queue is an rbtree keyed on sector, so sorting a request in costs
+ *   O(log n) and 'sorted' is filled by one in-order walk starting right
+ *   after the head and wrapping around to the lowest sector.
+ *
+ * Requests behind the window wait in arrival order on wait_queue and by
+ *   sector in wait_sort.  Back merges are found through the elevator hash,
+ *   keyed on where a request ends; front merges are looked up by sector in
+ *   sort_queue and wait_sort unless 'front_merges' is cleared in sysfs.  A
+ *   front merge moves the request, so it is sorted in again and, inside
+ *   the window, counts towards the dirty threshold.  A request merged
+ *   away leaves a tombstone in the plan, and once more than a quarter of
+ *   what is left of the plan is tombstones, it is calculated again.
+ *
+ * With a deep queue most requests wait, and taking them into the window
+ *   oldest first spreads it over the whole disk.  With 'bucket_sectors'
+ *   set in sysfs the disk is split into buckets of that many sectors, and
+ *   the window fills c-scan order by bucket instead: from the start of the
+ *   bucket the head is in, walking wait_sort and wrapping around.  The DP
+ *   then solves exactly over the buckets the head is about to sweep, while
+ *   the expiry still serves an overdue request from anywhere.  0, the
+ *   default, fills the window oldest first.
+ *
+ * One tenant flooding the queue would otherwise own the whole window.
+ *   With cgroups, each cgroup gets a share of the window in proportion to
+ *   its 'algot.weight', 1 to 1000 and 100 by default, among the cgroups
+ *   with requests of that direction queued, requests out of any cgroup
+ *   counting as one more.  Filling the window passes over requests of a
+ *   cgroup that holds its share already, unless all do.  The plan then
+ *   still minimises the seeks over the requests of all of them together.
+ *   A new weight is taken up once the cgroup has had nothing queued.
+ *
+ * The I/O priority class decides in what order waiting requests get into
+ *   the window: real-time ones first, oldest first, then the rest as
+ *   above.  Idle class requests only get in once nothing of a higher
+ *   class came in or went out for 'idle_delay' in sysfs, in ms, 200 by
+ *   default, and the queue is run again when that is up.  Expiry still
+ *   bounds their wait.  In the plan, the wait of a real-time request
+ *   weighs 'rt_weight' times as much, 4 by default and up to 1024.
+ *
+ * On a zoned device (SMR or ZNS), writes to a sequential zone have to
+ *   arrive at its write pointer in order, and the plan would reorder
+ *   them.  So each zone is write locked while a write to it is in flight,
+ *   as in mq-deadline, and those writes queue outside the plan, by sector
+ *   and with the first of each zone on a list in the order its zone got
+ *   one.  A write batch takes the first of the first zone not locked,
+ *   and once every zone written to is, the writes to conventional zones,
+ *   which are planned like reads, or reads meanwhile.  An overdue write
+ *   brings along the writes of its zone ahead of it.
+ *
+ * The matrix is laid out diagonal by diagonal, which is the order the
+ *   calculation sweeps it, and its cells shrink to 32 bits whenever the
+ *   sector span of the window guarantees no cost can overflow them.
+ *
+ * The sweep reads positions and neighbour distances from flat arrays
+ *   filled once per calculation.  On x86-64 with AVX2, narrow diagonals are
+ *   evaluated 8 cells at a time inside kernel_fpu_begin()/end().
+ *
+ * Seeks are costed by distance in sectors unless a model of the device is
+ *   written to 'seek_model' in sysfs: up to 16 "distance:cost" points of a
+ *   piecewise linear curve, e.g. measured seek times in us, which both the
+ *   calculation and the pick then go by.  A plan keeps a copy of the
+ *   model it was calculated with.
+ *
+ * On a platter, short seeks mostly wait for the sector to come round.  With
+ *   'rotation' set in sysfs to the spindle speed and the zones of the disk
+ *   as "rpm start:sectors_per_track ...", the window is served shortest
+ *   access time first instead: the seek from where the last request ended
+ *   plus the rotational wait, in us.  The angle of a sector follows from
+ *   its zone, and the angle of the head from where and when the last
+ *   request completed.  The seek model then has to be in us as well.
+ *
+ * A striped volume, RAID 0, 5 or 6 behind one queue, has a head on every
+ *   member, and the chunks of a row lie at the same depth on each: far
+ *   apart by sector, but all near once any member's head is there.  With
+ *   'stripe_aware' set in sysfs, the window is laid out in c-scan order
+ *   by depth on the members instead, from the depth of the head, and
+ *   costed by depth, taking one head for all: a row is swept as one
+ *   place and every member moves on with the sweep.  plan_gate keeps no
+ *   plan in that order, it has no sector neighbours to go by, and a plan
+ *   narrower than sort_queue still takes the requests nearest the head by
+ *   sector.  The layout is 'stripe_sectors' to a chunk over
+ *   'stripe_members' data members, as the volume reports in io_min and
+ *   io_opt unless written.  The members of an md or dm array each have
+ *   their own scheduler and see depth already, there the layout changes
+ *   nothing.  Off by default.
+ *
+ * Every seek delays all requests still waiting, and so does every transfer.
+ *   With 'transfer_cost' set in sysfs to what moving 1 MiB costs in the
+ *   unit of the seek model, each move is costed with the transfer of the
+ *   request it goes to, so a large request is not put ahead of many small
+ *   ones just because it is close.  0, the default, leaves transfers out.
+ *   Alone that defers large requests without end once the queue is
+ *   saturated; 'size_weight', in sectors, counts a request as one more
+ *   waiting request for every that many sectors it moves, so the delay of
+ *   a large request weighs in proportion.  0, the default, counts every
+ *   request once.  Both are bounded so the costliest window still fits a
+ *   cell: transfer_cost goes up to 1 s per MiB in us, size_weight down to
+ *   8, and no request transfers above 2^32 nor weighs more than 1024,
+ *   real-time ones included.
+ *
+ * The calculation itself lives in algot-core.h, which also builds in
+ *   userspace: tools/algot-replay replays blkparse captures through it on
+ *   a modelled disk, to evaluate changes offline against real traces.
+ *
+ * A cell of the matrix only depends on the requests inside its interval, so
+ *   unless 'incremental' is turned off in sysfs, the matrix is rebuilt in
+ *   a shadow copy: every interval whose requests are still adjacent in the
+ *   previous order is copied over and only intervals touched by new or
+ *   merged requests are recalculated.
+ *
+ * With 'async_rebuild' set in sysfs, a dirty plan is rebuilt by a work item
+ *   instead of inside dispatch: the requests are placed under the lock, the
+ *   matrix is filled without it while pick_opt() keeps serving the old plan,
+ *   and the new plan is swapped in under the lock once it is complete.
+ *
+ * The matrix grows with the square of the window, and for a handful of
+ *   requests it is not worth laying out: a plan of up to 'greedy_max'
+ *   requests in sysfs has none and serves the nearer end first.  Every
+ *   calculation times the cells it fills, and with 'program_budget' set
+ *   in sysfs, in us, a window wider than what fills in that time at the
+ *   measured rate is planned over only the requests nearest the head.
+ *   The rest stay in sort_queue for a later plan, expiry bounds their
+ *   wait.  0 plans over the whole window whatever it takes.
+ *
+ * Minimising the total seek lets a request far from the head starve while
+ *   new work keeps arriving close to it.  Like mq-deadline, every request
+ *   gets an expiry ('read_expire'/'write_expire' in sysfs, in ms) and the
+ *   oldest one is dispatched ahead of the plan once it is overdue.  The
+ *   plan is then rebuilt from where the head went.  sort_queue is also kept
+ *   in arrival order on 'fifo', wait_queue already is.
+ *
+ * A process reading a file sequentially and synchronously has nothing
+ *   queued between its reads, so the plan moves the head elsewhere just
+ *   before the next one arrives right behind the last.  With
+ *   'antic_expire' set in sysfs, in us, each io_context keeps how close
+ *   its reads start to where its last one ended and a histogram of how
+ *   long it thinks between a completion and its next read.  When the read
+ *   dispatched last comes from a stream that mostly reads on within
+ *   antic_expire, and it has nothing else queued, dispatch holds off until
+ *   its next read arrives, which then goes first, or antic_expire after
+ *   the read completed.  After fifo_batch reads in a row the plan gets a
+ *   turn, and expiry still goes ahead.  0, the default, never waits.
+ *
+ * Reads and writes have their own sort_queue, fifo and wait_queue, each
+ *   holding up to calc_max requests, and a plan only ever covers one of
+ *   them.  Requests go out in batches of up to 'fifo_batch' of the same
+ *   direction.  Reads are preferred, but after 'writes_starved' read
+ *   batches with writes pending, a write batch goes next.
+ *
+ * What the scheduler does is counted in algot_stats, shown in debugfs as
+ *   'stats', and add, dispatch and program events are logged to blktrace.
+ *
+ * Requests are inserted and dispatched through the blk-mq hooks.  The head
+ *   position is a property of the whole device, so all state lives in one
+ *   algot_data shared by every hardware context and protected by its lock.
+ *   Passthrough requests and requests inserted at head bypass the optimiser
+ *   and go out first through the dispatch list.
+ *
+ * Splitting the sort structures per hardware context or node would give
+ *   each of them its own head position, which no disk has.  Instead, when
+ *   the lock is taken, an insert does not wait for it: the requests are
+ *   staged on the hctx, allocated on its node, and whoever holds the lock
+ *   next sorts them in, dispatch at the latest.  Submitters on many CPUs
+ *   then only bounce their own hctx, not algot_data.
+ *
+ * Each dispatch call takes nd->lock to hand out a single request, which
+ *   with NCQ and a deep queue adds up.  With 'dispatch_batch' in sysfs
+ *   above 1, a call takes up to that many requests off the plan in use, no
+ *   more than the queue depth, onto 'ready', and the next calls hand them
+ *   out under ready_lock alone.  A batch stops where the plan turns
+ *   dirty, runs out or ends the batch of its direction, and where a
+ *   request is overdue or a stream waited for, so it never commits more
+ *   than the plan stood for.  The device reorders within it.
+ *
+ * Whatever the device holds it serves in its own order, out of reach of
+ *   the plan.  Dispatch counts requests in flight until they complete, and
+ *   with 'target_latency' set in sysfs, in us, it holds back once as many
+ *   are in flight as the device gets, and the completion of one runs the
+ *   queue again.  The device starts with the queue depth, and once per
+ *   window of completions gets a quarter less when their mean latency
+ *   went past the target, or one more when it stayed under 3/4 of it and
+ *   dispatch had to hold back.  What stays back is planned by the
+ *   scheduler.  0, the default, hands out all it can.  Completions also
+ *   show whether the device serves out of issue order, and while it does
+ *   with more than one request in flight, the head is taken from where
+ *   the last one completed rather than from where the last one went.
+ *
+ * What we keep per request is a struct algot_rq in elv.priv[0], from a
+ *   slab cache through a pool per queue that holds a queue depth of them
+ *   in reserve, on a zoned queue all it can ever have in flight and
+ *   queued, so allocating one never waits:
+ *   slot:      the location in array 'sorted' where pointer to this
+ *              request resides, or where else it is.
+ *   next_slot: same for the plan being calculated, until it is installed.
+ *   deadline:  when it expires while queued.
+ *   issued:    when it went to the driver, while in flight.
+ *   ic:        the stream it was queued in, if any.
+ *   moved:     a front merge moved it since it was last placed in a plan,
+ *              whose cells it then no longer fits.
+ *   A request that finds none bypasses the optimiser, as at-head and
+ *   passthrough requests do; on a zoned queue none goes without.
  */
+#include <linux/kernel.h>
 #include <linux/blkdev.h>
-#include <linux/elevator.h>
 #include <linux/bio.h>
 #include <linux/module.h>
 #include <linux/slab.h>
 #include <linux/init.h>
 #include <linux/vmalloc.h>
 #include <linux/printk.h>
+#include <linux/sbitmap.h>
+#include <linux/workqueue.h>
+#include <linux/blktrace_api.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
+#include <linux/log2.h>
+#include <linux/mutex.h>
+#include <linux/hrtimer.h>
+#include <linux/iocontext.h>
+#include <linux/ioprio.h>
+#include <linux/mempool.h>
+#include <linux/sort.h>
+
+#include <trace/events/block.h>
 
-/* Maxmium number of request we count into calculation */
+#ifdef CONFIG_X86_64
+#include <asm/cpufeature.h>
+#include <asm/fpu/api.h>
+#include <asm/simd.h>
+#endif
+
+#include "elevator.h"
+#include "blk.h"
+#include "blk-mq.h"
+#include "blk-mq-sched.h"
+#include "blk-mq-debugfs.h"
+#ifdef CONFIG_BLK_CGROUP
+#include "blk-cgroup.h"
+#endif
+#include "algot-core.h"
+
+#define algot_log(nd, fmt, args...) \
+    blk_add_trace_msg((nd)->queue, "algot " fmt, ##args)
+
+/* Default maxmium number of request we count into calculation */
 #define ALGOT_CALC_MAX  128
+/* Hard limit for calc_max, the matrix is calc_max^2 sector_t */
+#define ALGOT_CALC_LIMIT  1024
+/* Size of the window until requests have to wait, and after idling */
+#define ALGOT_CALC_MIN  16
+#define ALGOT_IDLE_RELEASE  (10 * HZ)
+
+/* Default expiry of a queued request, like mq-deadline */
+#define ALGOT_READ_EXPIRE   (HZ / 2)
+#define ALGOT_WRITE_EXPIRE  (5 * HZ)
 
-/* How many add requests occur before we consider previous matrix dirty */
+/* Default read batches before writes get one, and requests per batch */
+#define ALGOT_WRITES_STARVED  2
+#define ALGOT_FIFO_BATCH      16
+
+/* Default requests taken off the plan per dispatch call */
+#define ALGOT_DISPATCH_BATCH  1
+
+/* Default of how many add requests occur before we consider previous matrix dirty */
 #define ALGOT_DIRTY_COUNT  8
 #define ALGOT_DIRTY_RESET  (ALGOT_DIRTY_COUNT-1)
 
-/* Special values for algot_data.sorted */
-#define ALGOT_REF_MERGED     ((struct request*)0x0)
-#define ALGOT_REF_DISPATCHED ((struct request*)0x1)
+/* Default widest plan without a matrix */
+#define ALGOT_GREEDY_MAX  2
+
+/* Default time a calculation should take, in us, and a cell until timed */
+#define ALGOT_PROGRAM_BUDGET  500
+#define ALGOT_CELL_COST  (2 << 8)
+
+/*
+ * Default quiet time before idle class requests get into the window, like
+ *  CFQ's, and how much more the wait of a real-time request counts
+ */
+#define ALGOT_IDLE_DELAY  (HZ / 5)
+#define ALGOT_RT_WEIGHT   4
+
+/* Highest rt_weight, what one request weighs at most anyway */
+#define ALGOT_RT_WEIGHT_MAX  ALGOT_RQ_WEIGHT_MAX
+
+/*
+ * Highest transfer_cost, 1 s per MiB in us, and lowest size_weight other
+ *  than 0, a 4 KiB block
+ */
+#define ALGOT_XFER_COST_MAX    (1 << 20)
+#define ALGOT_SIZE_WEIGHT_MIN  8
+
+/* Default time to wait for a stream to read on, in us, 0 for never */
+#define ALGOT_ANTIC_EXPIRE  0
+
+/*
+ * Default completion latency to keep the device at, in us, 0 for no limit
+ *  on what is in flight.  The depth is adjusted once per that many
+ *  completions at least.
+ */
+#define ALGOT_TARGET_LATENCY  0
+#define ALGOT_DEPTH_WINDOW    8
+
+/* Default and range of algot.weight of a cgroup, like io.bfq.weight */
+#define ALGOT_WEIGHT      100
+#define ALGOT_WEIGHT_MIN  1
+#define ALGOT_WEIGHT_MAX  1000
+
+/* Replan once more than 1 in this many slots left of the plan is a tombstone */
+#define ALGOT_HOLE_SHARE  4
+
+/* Special values for algot_rq slots, out of range of any plan */
+#define ALGOT_SLOT_ZONED     (UINT_MAX-4)   // in zone_sort, written in zone order
+#define ALGOT_SLOT_ISSUED    (UINT_MAX-3)   // next_slot while in flight
+#define ALGOT_SLOT_NONE      (UINT_MAX-2)   // not queued here, or not in the plan
+#define ALGOT_SLOT_UNSORTED  (UINT_MAX-1)   // in wait_queue
+#define ALGOT_SLOT_SORTED    UINT_MAX       // in sort_queue, left out of the plan
+
+/* Buffers sized by win_cap, reallocated as a whole */
+struct algot_window {
+    struct algot_plan cur;  // plan pick_opt() serves from
+    struct algot_plan next; // plan being calculated, built from cur
+};
+
+/* Per io_context, how its synchronous reads follow each other */
+struct algot_icq {
+    struct io_cq icq;       // has to come first
+    struct algot_stream st;
+    u64 done_ns;            // when a read of it last completed, 0 since queued
+};
+
+/*
+ * What we keep of a request from algot_prepare_request() to
+ *  algot_finish_request(), kept by elv.priv[0]
+ */
+struct algot_rq {
+    unsigned int slot;      // index in win.cur.sorted, or ALGOT_SLOT_*
+    unsigned int next_slot; // index in win.next.sorted, or ALGOT_SLOT_*
+    unsigned long deadline; // jiffies it expires at, while queued
+    u64 issued;             // ns it went to the driver, while in flight
+    struct algot_icq *ic;   // stream it was queued in, or NULL
+    struct request *rq;     // the request this is of
+    struct list_head group; // in the waiting list of its group
+    struct list_head zone;  // in zones while the first queued of its zone
+    bool moved;             // front merged since algot_place(), not reused
+};
+
+static struct kmem_cache *algot_rq_cache __read_mostly;
+
+/*
+ * Per cgroup and queue, how much of the window its requests hold.  Counts
+ *  and lists are by data direction.
+ */
+struct algot_group {
+#ifdef CONFIG_BLK_CGROUP
+    struct blkg_policy_data pd;     // has to come first
+#endif
+    unsigned int weight;    // algot.weight when its first request came
+    unsigned int queued[2]; // requests of it in the scheduler
+    unsigned int windowed[2];   // of them in sort_queue
+    struct list_head waiting[2];    // of them in wait_queue, by expiry
+    struct list_head node[2];   // in wait_groups while waiting holds any
+};
+
+/* Per hardware context, requests inserted while nd->lock was taken */
+struct algot_stage {
+    spinlock_t lock;
+    struct list_head list;
+};
 
-/* Special values for request->elevator_private[0] */
-#define ALGOT_PRI0_UNSORTED  ((void*)-2)
-#define ALGOT_PRI0_SORTED    ((void*)-1)
+/* Counters shown in debugfs */
+struct algot_stats {
+    u64 programs;           // plans calculated
+    u64 program_ns;         // time spent calculating them
+    u64 program_reqs;       // sum of their widths
+    u64 greedy;             // plans without a matrix
+    u64 bounded;            // plans cut down to program_budget
+    u64 dispatched;         // slots of sorted left by dispatch
+    u64 merged;             // slots of sorted left by a merge
+    u64 compactions;        // plans redone to drop tombstones
+    u64 futile;             // plans that saved less than they took
+    u64 gated;              // picks from a dirty plan kept by plan_gate
+    u64 resizes;            // times the window was reallocated
+    u64 staged;             // requests inserted through an algot_stage
+    u64 unkept;             // requests left without a struct algot_rq
+    u64 readied;            // requests taken ahead onto ready
+    u64 front_merges;       // bios merged in front of a request
+    u64 back_merges;        // bios merged at the end of one
+    u64 discard_merges;     // discard bios merged into a discard
+    u64 expired;            // requests dispatched past their expiry
+    u64 antic;              // waits for a stream to read on
+    u64 antic_hits;         // its next read came in time
+    u64 antic_misses;       // antic_expire passed first
+    u64 throttled;          // dispatches held back by depth
+    u64 picks_left;         // pick_opt() took the start of the interval
+    u64 picks_right;        // pick_opt() took the end of the interval
+    u64 picks_inner;        // or, by access time, one in between
+    u64 head_travel;        // sectors between consecutive dispatches
+};
 
 struct algot_data {
-    struct list_head wait_queue;
-    struct list_head sort_queue;
+    struct request_queue *queue;
+    mempool_t *rq_pool;     // of struct algot_rq, algot_reserve() of them kept
+    spinlock_t lock;        // protects everything below
+
+    struct list_head dispatch;  // requests bypassing the optimiser
+
+    spinlock_t zone_lock;       // protects the zone write locks
+    spinlock_t ready_lock;      // protects ready alone
+    struct list_head ready;     // taken off the plan, for the next dispatches
+
+    /* Reads and writes queue apart, indexed by data direction */
+    struct list_head wait_queue[2];
+    struct list_head fifo[2];   // sort_queue in arrival order, on queuelist
+    struct rb_root sort_queue[2];
+    struct rb_root wait_sort[2];    // wait_queue keyed on sector
+    unsigned int nsorted[2];    // number of requests in sort_queue
+    unsigned int nwaiting[2];   // in wait_queue
+    unsigned int rt_waiting[2];     // of them real-time
+    unsigned int idle_waiting[2];   // and idle class
+    unsigned int groups[2];     // groups with requests queued
+    unsigned int group_weight[2];   // and the sum of their weights
+    struct list_head wait_groups[2];    // groups with requests waiting
+    struct algot_group nogroup; // where requests out of any cgroup count
 
-    struct request **sorted;// reference array sorted in c-scan order
-    sector_t *cost_matrix;  // algot computation matrix
+    /* Writes to sequential zones, outside the plan */
+    struct rb_root zone_sort;   // keyed on sector
+    struct list_head zone_fifo; // in order of expiry, on queuelist
+    struct list_head zones;     // first write of each zone, in order it came
+
+    struct algot_window win;
+    unsigned int win_cap;   // requests win has room for, up to calc_max
+    unsigned long busy;     // jiffies of the last insert
+    unsigned long fg_busy;  // and of the last one above the idle class in or out
 
     sector_t rw_head;
-    unsigned int nsorted;   // number of requests in sort_queue
+    sector_t rw_end;        // where the last dispatched request ends
+    sector_t done_pos;      // start of the last completed request
+    u64 done_ns;            // and when it completed
+    int dir;                // direction of the current batch
+    unsigned int batched;   // requests dispatched in the current batch
+    unsigned int starved;   // read batches while writes were waiting
     unsigned int opt_s;     // current start index
     unsigned int opt_e;     // current end index
-    unsigned int opt_ns;    // current table width for subscription
+    unsigned int holes;     // slots of the plan in use left by merges
+    struct algot_icq *antic;    // stream dispatch waits for
+    struct request *antic_rq;   // its next read, once it came
+    u64 antic_until;        // ns until when, U64_MAX while its read is out
+    unsigned int antic_run; // reads waited for in a row
+    struct hrtimer antic_timer;
+    u32 cell_cost;          // of filling a cell of the matrix, in 1/256 ns
+
+    /* In flight, updated from completions without nd->lock */
+    atomic_t inflight;      // issued and not completed yet
+    unsigned int depth;     // most in flight, 0 for no limit
+    bool throttled;         // dispatch held back, run the queue on completion
+    bool limited;           // depth held dispatch back since last adjusted
+    spinlock_t done_lock;   // protects the latency window below
+    u64 lat_sum;            // ns of the completions in the window
+    unsigned int lat_n;     // and how many
+    u64 lat_avg;            // mean latency of the last window, in ns
+    u64 done_issued;        // when the last request completed was issued
+    unsigned int reordered; // completions in the window issued before it
+    bool reordering;        // the device served the last window out of order
 
     int  dirty;             // dirty flag for cost_matrix & sorted
-    bool vloc;              // vmalloc flag for cost_matrix
+    int  dirty_limit;       // dirty count that recalculates
+    bool redo;              // a change plan_gate cannot skip the plan over
+    sector_t gate_shift;    // how far the requests left out can move the plan
+    bool rebuilding;        // rebuild_work owns win.next
+    struct work_struct rebuild_work;
+    struct delayed_work resize_work;
+    struct mutex resize_lock;   // serialises reallocating win
+
+    /* sysfs tunables */
+    unsigned int calc_max;  // size of calculation window
+    int dirty_count;        // dirty threshold
+    bool adapt_dirty;       // lower dirty_limit when plans are worth redoing
+    bool plan_gate;         // keep plans that new requests cannot change
+    bool incremental;       // reuse unchanged intervals of the last plan
+    bool narrow_matrix;     // use u32 cells when the costs fit
+    bool async_rebuild;     // rebuild dirty plans in rebuild_work
+    bool front_merges;      // look up front merges
+    bool stripe_aware;      // order plans by depth on the members of stripe
+    struct algot_stripe stripe; // layout stripe_aware goes by
+    unsigned int bucket_sectors;    // fill the window by bucket, 0 by age
+    unsigned int antic_expire;  // wait for a stream to read on, in us
+    unsigned int target_latency;    // completion latency to keep to, in us
+    unsigned int greedy_max;    // widest plan without a matrix
+    unsigned int program_budget;    // time a calculation should take, in us
+    unsigned long fifo_expire[2];   // READ/WRITE expiry, in jiffies
+    unsigned int writes_starved;    // read batches before writes get one
+    unsigned int fifo_batch;        // requests per batch
+    unsigned int dispatch_batch;    // requests taken off the plan per dispatch
+    struct algot_model model;       // seek costs for the next plan
+    struct algot_rotation rot;      // rotational costs for the next plan
+    unsigned int xfer_cost;         // cost of transferring 1 MiB
+    unsigned int size_weight;       // sectors per extra unit of weight
+    unsigned int rt_weight;         // weight factor of real-time requests
+    unsigned long idle_delay;       // quiet time before idle class, in jiffies
+
+    unsigned int async_depth;   // tag limit for async requests and writes
+
+    struct algot_stats stats;
 };
 
+/* NULL for a request that went without, it bypasses the optimiser */
+static inline struct algot_rq *algot_rq(struct request *rq)
+{
+    return rq->elv.priv[0];
+}
 
-static inline void algot_sort_in(struct algot_data *nd, struct request *rq)
+static inline bool algot_queued(struct algot_data *nd, int dir)
 {
-    sector_t pos;
-    struct request *req;
+    return !RB_EMPTY_ROOT(&nd->sort_queue[dir]) ||
+        !list_empty(&nd->wait_queue[dir]) ||
+        (dir == WRITE && !list_empty(&nd->zone_fifo));
+}
 
-    rq->elevator_private[0] = ALGOT_PRI0_SORTED;
-    pos = blk_rq_pos(rq);
-    list_for_each_entry(req, &nd->sort_queue, queuelist)
-    {
-        if (blk_rq_pos(req) > pos)
-            break;
-    }
-    list_add_tail(&rq->queuelist, &req->queuelist);
-    nd->nsorted += 1;
-    nd->dirty += 1;
+/* Writes to sequential zones have to reach the device in sector order */
+static inline bool algot_zoned(struct algot_data *nd)
+{
+    return blk_queue_is_zoned(nd->queue);
 }
 
-static void algot_merged_requests(struct request_queue *q, struct request *rq,
-                 struct request *next)
+/* Whether plans go by depth on the members of a stripe */
+static inline bool algot_striped(struct algot_data *nd)
 {
-    void* ref = next->elevator_private[0];
-    if (ref != ALGOT_PRI0_UNSORTED)
-    {
-        struct algot_data* nd = q->elevator->elevator_data;
-        nd->nsorted -= 1;
+    return nd->stripe_aware && nd->stripe.chunk && nd->stripe.width > 1;
+}
 
-        if (ref != ALGOT_PRI0_SORTED)
-        {
-            BUG_ON((uintptr_t)ref > ALGOT_CALC_MAX);
-            nd->sorted[(uintptr_t)ref] = ALGOT_REF_MERGED;
-        }
-    }
-    list_del_init(&next->queuelist);
+static inline int algot_class(struct request *rq)
+{
+    return IOPRIO_PRIO_CLASS(req_get_ioprio(rq));
 }
 
-static void algot_add_request(struct request_queue *q, struct request *rq)
+/* Whether nothing above the idle class came or went for idle_delay */
+static inline bool algot_quiet(struct algot_data *nd)
 {
-    struct algot_data *nd = q->elevator->elevator_data;
+    return time_after_eq(jiffies, nd->fg_busy + nd->idle_delay);
+}
 
-    while (!list_empty(&nd->wait_queue) && nd->nsorted < ALGOT_CALC_MAX)
-    {
-        struct request *req = list_entry_rq(nd->wait_queue.next);
-        list_del_init(&req->queuelist);
-        algot_sort_in(nd, req);
-    }
+/* Whether dir has requests to serve now, not only idle class ones waiting */
+static inline bool algot_ready(struct algot_data *nd, int dir)
+{
+    return !RB_EMPTY_ROOT(&nd->sort_queue[dir]) ||
+        (dir == WRITE && !list_empty(&nd->zone_fifo)) ||
+        nd->nwaiting[dir] > nd->idle_waiting[dir] ||
+        (nd->nwaiting[dir] && algot_quiet(nd));
+}
 
-    if (list_empty(&nd->wait_queue) && nd->nsorted < ALGOT_CALC_MAX)
-        algot_sort_in(nd, rq);
-    else
-    {
-        rq->elevator_private[0] = ALGOT_PRI0_UNSORTED;
-        list_add_tail(&rq->queuelist, &nd->wait_queue);
-    }
+/* Jiffies until idle class requests held back may go, 0 if none wait */
+static unsigned long algot_held(struct algot_data *nd)
+{
+    long left = nd->fg_busy + nd->idle_delay - jiffies;
+
+    if (!nd->idle_waiting[READ] && !nd->idle_waiting[WRITE])
+        return 0;
+    return max(left, 1L);
 }
 
-#define MIN(a,b) (a<b)?a:b
-#define MATRIX(matrix, width, i, j)  (matrix[(i)*(width) + (j)])
+#ifdef CONFIG_BLK_CGROUP
+static struct blkcg_policy algot_blkcg_policy;
+
+/* Per cgroup, the share of the window it gets */
+struct algot_cgroup {
+    struct blkcg_policy_data cpd;   // has to come first
+    unsigned int weight;
+};
+#endif
 
-static inline sector_t
-sect_dist(struct request **sorted, unsigned long i, unsigned long j)
+/* The group rq is accounted to, nogroup without cgroups */
+static inline struct algot_group *algot_group(struct request *rq)
 {
-    if (sorted[j] == NULL)
+    struct algot_data *nd = rq->q->elevator->elevator_data;
+#ifdef CONFIG_BLK_CGROUP
+    struct blkg_policy_data *pd;
+
+    if (rq->bio && rq->bio->bi_blkg)
     {
-        printk(KERN_ALERT "%lu %lu\n", i, j);
+        pd = blkg_to_pd(rq->bio->bi_blkg, &algot_blkcg_policy);
+        if (pd)
+            return container_of(pd, struct algot_group, pd);
     }
-    return abs(blk_rq_pos(sorted[i])-blk_rq_pos(sorted[j]));
+#endif
+    return &nd->nogroup;
 }
 
-static inline void algot_program(struct request_queue *q, struct algot_data *nd)
+static void algot_group_init(struct algot_group *g)
 {
-    sector_t *mx = nd->cost_matrix;
-    struct request **sa = nd->sorted;
-    sector_t rw_head = nd->rw_head;
-    uintptr_t idx = 0;
-    struct request *req;
-    sector_t cl, cr;
-    unsigned int i, j, k, ns;
+    int dir;
 
-    while (!list_empty(&nd->wait_queue) && nd->nsorted < ALGOT_CALC_MAX)
+    for (dir = READ; dir <= WRITE; dir++)
     {
-        req = list_entry_rq(nd->wait_queue.next);
-        list_del_init(&req->queuelist);
-        algot_sort_in(nd, req);
+        INIT_LIST_HEAD(&g->waiting[dir]);
+        INIT_LIST_HEAD(&g->node[dir]);
     }
+}
 
-    nd->opt_ns = ns = nd->nsorted;
+static unsigned int algot_group_weight(struct algot_group *g)
+{
+#ifdef CONFIG_BLK_CGROUP
+    struct blkcg_policy_data *cpd;
+
+    if (!pd_to_blkg(&g->pd))
+        return ALGOT_WEIGHT;
+    cpd = blkcg_to_cpd(pd_to_blkg(&g->pd)->blkcg, &algot_blkcg_policy);
+    if (cpd)
+        return READ_ONCE(container_of(cpd, struct algot_cgroup, cpd)->weight);
+#endif
+    return ALGOT_WEIGHT;
+}
+
+/*
+ * rq comes into the scheduler or leaves it.  A group takes its weight
+ *  along in the direction of rq while it has requests queued there, and
+ *  takes up a new one once it has none in either.  Called with nd->lock
+ *  held.
+ */
+static void algot_group_queue(struct algot_data *nd, struct request *rq,
+                 bool in)
+{
+    struct algot_group *g = algot_group(rq);
+    int dir = rq_data_dir(rq);
 
-    list_for_each_entry(req, &nd->sort_queue, queuelist)
+    if (in && !g->queued[dir]++)
     {
-        if (blk_rq_pos(req) > rw_head)
-        {
-            req->elevator_private[0] = (void*)idx;
-            sa[idx++] = req;
-        }
+        if (!g->queued[!dir])
+            g->weight = algot_group_weight(g);
+        nd->groups[dir]++;
+        nd->group_weight[dir] += g->weight;
     }
-    list_for_each_entry(req, &nd->sort_queue, queuelist)
+    else if (!in && !--g->queued[dir])
     {
-        if (blk_rq_pos(req) > rw_head)
-            break;
-        req->elevator_private[0] = (void*)idx;
-        sa[idx++] = req;
-    }
-    
-    for(i = 0; i < ns; i++)
-        MATRIX(mx, ns, i, i) = 0;
-    
-    for(k = 1; k <= ns; k++) {
-        for(i=0; i < ns-k; i++) {
-            j = k+i;
-            cl = k*sect_dist(sa, i, i+1) + MATRIX(mx, ns, i+1, j); 
-            cr = k*sect_dist(sa, i, j)   + MATRIX(mx, ns, j, i+1);
-            MATRIX(mx, ns, i, j) = MIN(cl, cr);
-
-            cl = k*sect_dist(sa, j, j-1) + MATRIX(mx, ns, j-1, i);
-            cr = k*sect_dist(sa, i, j)   + MATRIX(mx, ns, i, j-1);
-            MATRIX(mx, ns, j, i) = MIN(cl, cr);
-        }
+        nd->groups[dir]--;
+        nd->group_weight[dir] -= g->weight;
     }
-    nd->opt_s = 0;
-    nd->opt_e = ns-1;
-    nd->dirty = 0;
 }
 
-static inline struct request *
-pick_opt(struct request_queue *q, struct algot_data* nd)
+/* rq moves n slots into the window, or out of it for n < 0 */
+static inline void algot_group_window(struct request *rq, int n)
 {
-    sector_t *matrix = nd->cost_matrix;
-    struct request** sorted = nd->sorted;
-    sector_t rw_head = nd->rw_head;
-    unsigned int s = nd->opt_s;
-    unsigned int e = nd->opt_e;
-    unsigned int cnt = nd->opt_ns;
-    unsigned int i;
-    sector_t val_l, val_r;
-    struct request* rq;
+    algot_group(rq)->windowed[rq_data_dir(rq)] += n;
+}
 
-    while (sorted[s] == ALGOT_REF_MERGED)
-        s++;
+/*
+ * Whether g may take a slot of the window of dir: with more than one
+ *  group queued there, not while it holds its share by weight already.
+ */
+static inline bool algot_fair(struct algot_data *nd, struct algot_group *g,
+                 int dir)
+{
+    return nd->groups[dir] < 2 ||
+        (u64)g->windowed[dir] * nd->group_weight[dir] <
+        (u64)nd->win_cap * g->weight;
+}
 
-    while (sorted[e] == ALGOT_REF_MERGED)
-        e--;
-    
-    if (s != e)
-    {
-        val_l = abs(e-s+1)*abs(rw_head - blk_rq_pos(sorted[s])) + MATRIX(matrix, cnt, s, e);
-        val_r = abs(e-s+1)*abs(rw_head - blk_rq_pos(sorted[e])) + MATRIX(matrix, cnt, e, s);
+/*
+ * rq joins the waiting list of its group, by expiry like wait_queue, or
+ *  leaves it.  The group is in wait_groups while it has any.
+ */
+static void algot_group_wait(struct algot_data *nd, struct request *rq,
+                 bool in)
+{
+    struct algot_group *g = algot_group(rq);
+    struct algot_rq *m = algot_rq(rq);
+    int dir = rq_data_dir(rq);
+    struct list_head *pos = g->waiting[dir].prev;
 
-        if (val_l<=val_r)
-        {
-            nd->opt_s = s+1;
-            i = s;
-        }
-        else
-        {
-            nd->opt_e = e-1;
-            i = e;
-        }
-    }
-    else
+    if (!in)
     {
-        i = s;
-        /* 
-         * Empty matrix is always marked as 'dirty' because 
-         *  there may be unprocessed requests in sort_queue
-         */
-        nd->dirty = ALGOT_DIRTY_COUNT;
+        list_del_init(&m->group);
+        if (list_empty(&g->waiting[dir]))
+            list_del_init(&g->node[dir]);
+        return;
     }
+    if (list_empty(&g->waiting[dir]))
+        list_add_tail(&g->node[dir], &nd->wait_groups[dir]);
+    while (pos != &g->waiting[dir] &&
+           time_after(list_entry(pos, struct algot_rq, group)->deadline,
+                      m->deadline))
+        pos = pos->prev;
+    list_add(&m->group, pos);
+}
 
-    rq = sorted[i];
-    if (rq == ALGOT_REF_DISPATCHED)
-        BUG();
+/* rq joins wait_queue, or leaves it for n < 0 */
+static inline void algot_count_wait(struct algot_data *nd, struct request *rq,
+                 int n)
+{
+    int dir = rq_data_dir(rq);
+
+    nd->nwaiting[dir] += n;
+    algot_group_wait(nd, rq, n > 0);
+    if (algot_class(rq) == IOPRIO_CLASS_RT)
+        nd->rt_waiting[dir] += n;
+    else if (algot_class(rq) == IOPRIO_CLASS_IDLE)
+        nd->idle_waiting[dir] += n;
+}
+
+/*
+ * Put rq in list, fifo, wait_queue or zone_fifo, where its deadline goes, looking
+ *  back from pos.  algot_expired() only looks at the first of each, so
+ *  they are kept in order of expiry, which is arrival order but for
+ *  requests merged or moved back from the window.
+ */
+static inline void algot_fifo_add(struct list_head *list,
+                 struct list_head *pos, struct request *rq)
+{
+    while (pos != list &&
+           time_after(algot_rq(list_entry_rq(pos))->deadline,
+                      algot_rq(rq)->deadline))
+        pos = pos->prev;
+    list_add(&rq->queuelist, pos);
+}
+
+/* Queue rq behind the window */
+static inline void algot_wait(struct algot_data *nd, struct request *rq)
+{
+    int dir = rq_data_dir(rq);
+
+    algot_rq(rq)->slot = ALGOT_SLOT_UNSORTED;
+    algot_count_wait(nd, rq, 1);
+    algot_fifo_add(&nd->wait_queue[dir], nd->wait_queue[dir].prev, rq);
+    elv_rb_add(&nd->wait_sort[dir], rq);
+}
+
+static inline void algot_unwait(struct algot_data *nd, struct request *rq)
+{
+    algot_count_wait(nd, rq, -1);
+    list_del_init(&rq->queuelist);
+    elv_rb_del(&nd->wait_sort[rq_data_dir(rq)], rq);
+}
+
+/*
+ * Where the head is: where the last request went, unless the device
+ *  serves more than one in its own order, then where the last one
+ *  completed.
+ */
+static inline sector_t algot_head(struct algot_data *nd)
+{
+    if (READ_ONCE(nd->reordering) && atomic_read(&nd->inflight) > 1)
+        return READ_ONCE(nd->done_pos);
+    return nd->rw_head;
+}
 
-    if (rq == ALGOT_REF_MERGED)
+/* The first request in root at or after sector, NULL if there is none */
+static struct rb_node *algot_rb_lower(struct rb_root *root, sector_t sector)
+{
+    struct rb_node *node = root->rb_node, *next = NULL;
+
+    while (node)
     {
-        return pick_opt(q, nd);
+        if (blk_rq_pos(rb_entry_rq(node)) >= sector)
+        {
+            next = node;
+            node = node->rb_left;
+        }
+        else
+            node = node->rb_right;
     }
+    return next;
+}
 
-    sorted[i] = ALGOT_REF_DISPATCHED;
+/*
+ * The first write queued for the zone rq writes to, the one that has to
+ *  go before all others of the zone.  Called with nd->lock held.
+ */
+static struct request *algot_zone_first(struct algot_data *nd,
+                 struct request *rq)
+{
+    sector_t start = round_down(blk_rq_pos(rq), nd->queue->limits.chunk_sectors);
 
-    nd->rw_head = blk_rq_pos(rq);
-    list_del_init(&rq->queuelist);
-    nd->nsorted--;
-    return rq;
+    return rb_entry_rq(algot_rb_lower(&nd->zone_sort, start));
 }
 
-static int algot_dispatch(struct request_queue *q, int force)
+/* Whether a and b write to the same zone */
+static inline bool algot_same_zone(struct algot_data *nd, struct request *a,
+                 struct request *b)
 {
-    struct algot_data *nd = q->elevator->elevator_data;
+    sector_t zone = nd->queue->limits.chunk_sectors;
 
-    if (!list_empty(&nd->sort_queue) || !list_empty(&nd->wait_queue)) {
-        struct request *rq;
+    return round_down(blk_rq_pos(a), zone) == round_down(blk_rq_pos(b), zone);
+}
 
-        if (nd->dirty >= ALGOT_DIRTY_COUNT)
-            algot_program(q, nd);
-        rq = pick_opt(q, nd);
+/*
+ * rq, in zone_sort already, stands for its zone in zones if it is the
+ *  first of it: in the place of the one it went in front of, or at the
+ *  end for a zone that had none.
+ */
+static void algot_zone_link(struct algot_data *nd, struct request *rq)
+{
+    struct rb_node *node = rb_prev(&rq->rb_node);
+    struct request *next;
 
-        elv_dispatch_sort(q, rq);
-        return 1;
-    }
-    return 0;
+    if (node && algot_same_zone(nd, rb_entry_rq(node), rq))
+        return;
+    node = rb_next(&rq->rb_node);
+    next = node ? rb_entry_rq(node) : NULL;
+    if (next && algot_same_zone(nd, next, rq) &&
+        !list_empty(&algot_rq(next)->zone))
+        list_replace_init(&algot_rq(next)->zone, &algot_rq(rq)->zone);
+    else
+        list_add_tail(&algot_rq(rq)->zone, &nd->zones);
 }
 
-static struct request *
-algot_former_request(struct request_queue *q, struct request *rq)
+/* Queue rq, a write to a sequential zone, in zone order */
+static void algot_zone_add(struct algot_data *nd, struct request *rq)
 {
-    struct algot_data *nd = q->elevator->elevator_data;
+    algot_rq(rq)->slot = ALGOT_SLOT_ZONED;
+    algot_fifo_add(&nd->zone_fifo, nd->zone_fifo.prev, rq);
+    elv_rb_add(&nd->zone_sort, rq);
+    algot_zone_link(nd, rq);
+}
 
-    if (rq->queuelist.prev == &nd->sort_queue || rq->queuelist.prev == &nd->wait_queue)
-        return NULL;
-    return list_entry(rq->queuelist.prev, struct request, queuelist);
+/* rq leaves zone_sort, the next of its zone stands for it in zones */
+static void algot_zone_del(struct algot_data *nd, struct request *rq)
+{
+    struct rb_node *node = rb_next(&rq->rb_node);
+    struct algot_rq *m = algot_rq(rq);
+
+    if (!list_empty(&m->zone))
+    {
+        if (node && algot_same_zone(nd, rb_entry_rq(node), rq))
+            list_replace_init(&m->zone, &algot_rq(rb_entry_rq(node))->zone);
+        else
+            list_del_init(&m->zone);
+    }
+    elv_rb_del(&nd->zone_sort, rq);
+    list_del_init(&rq->queuelist);
 }
 
-static struct request *
-algot_latter_request(struct request_queue *q, struct request *rq)
+/*
+ * The first write of the zone that came first among those no write is
+ *  in flight to, NULL when every zone written to is busy.  Called with
+ *  nd->lock held.
+ */
+static struct request *algot_zone_write(struct algot_data *nd)
 {
-    struct algot_data *nd = q->elevator->elevator_data;
+    struct algot_rq *m;
+    struct request *found = NULL;
+    unsigned long flags;
 
-    if (rq->queuelist.next == &nd->sort_queue || rq->queuelist.next == &nd->wait_queue)
-        return NULL;
-    return list_entry(rq->queuelist.next, struct request, queuelist);
+    spin_lock_irqsave(&nd->zone_lock, flags);
+    list_for_each_entry(m, &nd->zones, zone)
+    {
+        if (blk_req_can_dispatch_to_zone(m->rq))
+        {
+            found = m->rq;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&nd->zone_lock, flags);
+    return found;
 }
 
-static void *algot_init_queue(struct request_queue *q)
+/* Whether a expires ahead of b */
+static inline bool algot_older(struct request *a, struct request *b)
 {
-    struct algot_data *nd;
-    unsigned long ms = ALGOT_CALC_MAX;
+    return time_before(algot_rq(a)->deadline, algot_rq(b)->deadline);
+}
 
-    nd = kmalloc_node(sizeof(*nd), GFP_KERNEL, q->node);
-    nd->nsorted = 0;
-    nd->rw_head = 0;
-    nd->dirty = ALGOT_DIRTY_COUNT-1;
-    INIT_LIST_HEAD(&nd->wait_queue);
-    INIT_LIST_HEAD(&nd->sort_queue);
+/* The oldest waiting request of g in dir, passing over held idle ones */
+static struct request *algot_group_first(struct algot_group *g, int dir,
+                 bool held)
+{
+    struct algot_rq *m;
 
-    nd->vloc = false;
-    nd->cost_matrix = kmalloc_node(sizeof(sector_t)*ms*ms, GFP_KERNEL, q->node);
-    if (nd->cost_matrix == NULL)
+    list_for_each_entry(m, &g->waiting[dir], group)
     {
-        nd->cost_matrix = vmalloc_node(sizeof(sector_t)*ms*ms, q->node);
-        nd->vloc = true;
+        if (!held || algot_class(m->rq) != IOPRIO_CLASS_IDLE)
+            return m->rq;
     }
-    nd->sorted = kmalloc_node(sizeof(void*)*ms, GFP_KERNEL, q->node);
+    return NULL;
+}
 
-    if (!nd || !nd->sorted || !nd->cost_matrix)
+/* The first sector of the bucket_sectors bucket pos is in */
+static inline sector_t algot_bucket_start(struct algot_data *nd, sector_t pos)
+{
+    sector_div(pos, nd->bucket_sectors);
+    return pos * nd->bucket_sectors;
+}
+
+/*
+ * The waiting request to move into the window next: a real-time one,
+ *  oldest first, otherwise the oldest one or by bucket, passing over groups
+ *  that hold their share.  If all do, the first one goes anyway.  Idle
+ *  class requests wait until the device is quiet, NULL if only they are
+ *  left.  Oldest first takes the oldest of each group waiting, by bucket
+ *  only walks the queue when some group is short of its share.  Called
+ *  with nd->lock held and wait_queue[dir] not empty.
+ */
+static struct request *algot_admit(struct algot_data *nd, int dir)
+{
+    struct rb_node *node, *next;
+    sector_t start = algot_head(nd);
+    bool held = nd->idle_waiting[dir] && !algot_quiet(nd);
+    struct request *rq, *first = NULL, *fair = NULL;
+    struct algot_group *g;
+    bool short_of = false;
+
+    if (nd->rt_waiting[dir])
+        list_for_each_entry(rq, &nd->wait_queue[dir], queuelist)
+            if (algot_class(rq) == IOPRIO_CLASS_RT)
+                return rq;
+
+    if (!nd->bucket_sectors)
     {
-        printk(KERN_ALERT "failed to allocate memory for algot\n");
-        return NULL;
+        if (nd->groups[dir] < 2 && !held)
+            return list_entry_rq(nd->wait_queue[dir].next);
+        list_for_each_entry(g, &nd->wait_groups[dir], node[dir])
+        {
+            rq = algot_group_first(g, dir, held);
+            if (!rq)
+                continue;
+            if (!algot_fair(nd, g, dir))
+            {
+                if (!first || algot_older(rq, first))
+                    first = rq;
+            }
+            else if (!fair || algot_older(rq, fair))
+                fair = rq;
+        }
+        return fair ?: first;
     }
 
-    return nd;
+    /* C-scan over buckets, from the start of the bucket the head is in */
+    next = algot_rb_lower(&nd->wait_sort[dir], algot_bucket_start(nd, start));
+    if (!next)
+        next = rb_first(&nd->wait_sort[dir]);
+    if (nd->groups[dir] < 2 && !held)
+        return rb_entry_rq(next);
+
+    list_for_each_entry(g, &nd->wait_groups[dir], node[dir])
+        short_of |= algot_fair(nd, g, dir);
+    node = next;
+    do
+    {
+        rq = rb_entry_rq(node);
+        if ((!held || algot_class(rq) != IOPRIO_CLASS_IDLE) &&
+            (!short_of || algot_fair(nd, algot_group(rq), dir)))
+            return rq;
+        node = rb_next(node) ?: rb_first(&nd->wait_sort[dir]);
+    } while (node != next);
+    return NULL;
 }
 
-static void algot_exit_queue(struct elevator_queue *e)
+/*
+ * The head goes to rq of the plan, a request left out right next to it
+ *  is no longer between live neighbours.  Called with nd->lock held.
+ */
+static inline void algot_passing(struct algot_data *nd, struct request *rq)
 {
-    struct algot_data *nd = e->elevator_data;
+    struct rb_node *prev = rb_prev(&rq->rb_node);
+    struct rb_node *next = rb_next(&rq->rb_node);
 
-    BUG_ON(!list_empty(&nd->sort_queue));
-    if (nd->vloc)
-        vfree(nd->cost_matrix);
-    else
-        kfree(nd->cost_matrix);
-    kfree(nd->sorted);
-    kfree(nd);
+    if ((prev && algot_rq(rb_entry_rq(prev))->slot == ALGOT_SLOT_SORTED) ||
+        (next && algot_rq(rb_entry_rq(next))->slot == ALGOT_SLOT_SORTED))
+        nd->redo = true;
 }
 
-static struct elevator_type elevator_algot = {
-    .ops = {
-        .elevator_merge_req_fn        = algot_merged_requests,
-        .elevator_dispatch_fn        = algot_dispatch,
-        .elevator_add_req_fn        = algot_add_request,
-        .elevator_former_req_fn        = algot_former_request,
-        .elevator_latter_req_fn        = algot_latter_request,
-        .elevator_init_fn        = algot_init_queue,
-        .elevator_exit_fn        = algot_exit_queue,
-    },
-    .elevator_name = "algot",
-    .elevator_owner = THIS_MODULE,
-};
+/* The plan in use has to be calculated again, called with nd->lock held */
+static inline void algot_redo(struct algot_data *nd)
+{
+    nd->dirty = nd->dirty_limit;
+    nd->redo = true;
+}
 
-static int __init algot_init(void)
+/*
+ * The nearest request of the plan in use before or after rq in sort_queue,
+ *  passing over up to n requests left out of it.  NULL when there is none.
+ */
+static struct request *algot_planned(struct request *rq, bool after, int n)
 {
-    elv_register(&elevator_algot);
+    struct rb_node *node = &rq->rb_node;
 
-    return 0;
+    do
+    {
+        node = after ? rb_next(node) : rb_prev(node);
+        if (!node)
+            return NULL;
+        rq = rb_entry_rq(node);
+    } while (algot_rq(rq)->slot == ALGOT_SLOT_SORTED && n-- > 0);
+    return rq;
+}
+
+/*
+ * rq, just sorted in, is left out of the plan in use until it is
+ *  calculated again.  Unless it falls between two live neighbours of the
+ *  plan, away from the head, the plan cannot be kept any longer than
+ *  dirty_limit allows; otherwise add up how far it can move the first
+ *  move, see algot_stale().  Other requests left out before it may lie
+ *  in between.  A plan in member order has no neighbours by sector.
+ *  Called with nd->lock held.
+ */
+static void algot_gate(struct algot_data *nd, struct request *rq)
+{
+    struct algot_plan *p = &nd->win.cur;
+    unsigned int s = nd->opt_s, e = nd->opt_e;
+    struct request *prev, *next;
+    unsigned int a, b;
+
+    if (nd->redo || !nd->plan_gate)
+        return;
+
+    prev = algot_planned(rq, false, nd->dirty);
+    next = algot_planned(rq, true, nd->dirty);
+    if (!prev || !next || p->rot.nz || p->stripe.width ||
+        !algot_trim(p, &s, &e))
+    {
+        nd->redo = true;
+        return;
+    }
+
+    /* The head gap has them the other way round, markers are out of range */
+    a = algot_rq(prev)->slot;
+    b = algot_rq(next)->slot;
+    if (a < s || a >= b || b > e)
+    {
+        nd->redo = true;
+        return;
+    }
+    nd->gate_shift += algot_shift(p, s, e, a, b, rq);
+}
+
+static inline void algot_sort_in(struct algot_data *nd, struct request *rq)
+{
+    int dir = rq_data_dir(rq);
+
+    algot_fifo_add(&nd->fifo[dir], nd->fifo[dir].prev, rq);
+
+    algot_rq(rq)->slot = ALGOT_SLOT_SORTED;
+    elv_rb_add(&nd->sort_queue[dir], rq);
+    nd->nsorted[dir] += 1;
+    algot_group_window(rq, 1);
+    if (dir == nd->dir)
+    {
+        nd->dirty += 1;
+        algot_gate(nd, rq);
+    }
+}
+
+/* rq leaves while a rebuild has it in the next plan, called with nd->lock held */
+static inline void algot_forget(struct algot_data *nd, struct request *rq)
+{
+    struct algot_rq *m = algot_rq(rq);
+
+    if (m->next_slot == ALGOT_SLOT_NONE)
+        return;
+    nd->win.next.sorted[m->next_slot] = ALGOT_REF_MERGED;
+    m->next_slot = ALGOT_SLOT_NONE;
+}
+
+/*
+ * Merges or requests taken out of turn left n more tombstones in the plan
+ *  in use.  Skipping them is cheap, but the matrix still routes the head
+ *  through them, so once too much of what is left is dead the plan is
+ *  calculated again without.  holes counts the tombstones inside
+ *  [opt_s, opt_e], which pick_opt() trims as it goes.
+ */
+static inline void algot_holes(struct algot_data *nd, unsigned int n)
+{
+    nd->holes += n;
+    if (nd->holes * ALGOT_HOLE_SHARE > nd->opt_e - nd->opt_s + 1 &&
+        nd->dirty < nd->dirty_limit)
+    {
+        algot_redo(nd);
+        nd->stats.compactions++;
+    }
+}
+
+/* pick_opt() trimmed n tombstones off the live interval */
+static inline void algot_unhole(struct algot_data *nd, unsigned int n)
+{
+    nd->holes -= min(nd->holes, n);
+}
+
+/* The io_context of a synchronous read, the only requests streams track */
+static inline struct algot_icq *algot_stream(struct request *rq)
+{
+    if (rq_data_dir(rq) != READ || !rq_is_sync(rq) || !rq->elv.icq)
+        return NULL;
+    return container_of(rq->elv.icq, struct algot_icq, icq);
+}
+
+/* The stream rq counts in, set by algot_add_request() */
+static inline struct algot_icq *algot_icq(struct request *rq)
+{
+    struct algot_rq *m = algot_rq(rq);
+
+    return m ? m->ic : NULL;
+}
+
+/* A read of ic arrives, called with nd->lock held */
+static void algot_think(struct algot_icq *ic, struct request *rq)
+{
+    algot_stream_read(&ic->st, blk_rq_pos(rq), blk_rq_sectors(rq),
+                      READ_ONCE(ic->done_ns), ktime_get_ns());
+    WRITE_ONCE(ic->done_ns, 0);
+}
+
+static enum hrtimer_restart algot_antic_timer(struct hrtimer *timer)
+{
+    struct algot_data *nd = container_of(timer, struct algot_data, antic_timer);
+
+    blk_mq_run_hw_queues(nd->queue, true);
+    return HRTIMER_NORESTART;
+}
+
+/* Called with nd->lock held */
+static void algot_merged_requests(struct request_queue *q, struct request *rq,
+                 struct request *next)
+{
+    struct algot_data* nd = q->elevator->elevator_data;
+    unsigned int ref = algot_rq(next)->slot;
+    int dir = rq_data_dir(next);
+    struct algot_icq *ic = algot_icq(next);
+
+    if (ic)
+        ic->st.queued--;
+    if (nd->antic_rq == next)
+        nd->antic_rq = rq;
+
+    /* rq inherits the expiry of next if it was queued earlier */
+    if (algot_rq(rq)->slot != ALGOT_SLOT_NONE && ref != ALGOT_SLOT_NONE &&
+        time_before(algot_rq(next)->deadline, algot_rq(rq)->deadline))
+    {
+        struct list_head *pos = rq->queuelist.prev;
+
+        algot_rq(rq)->deadline = algot_rq(next)->deadline;
+        list_del_init(&rq->queuelist);
+        if (algot_rq(rq)->slot == ALGOT_SLOT_UNSORTED)
+        {
+            algot_fifo_add(&nd->wait_queue[dir], pos, rq);
+            algot_group_wait(nd, rq, false);
+            algot_group_wait(nd, rq, true);
+        }
+        else if (algot_rq(rq)->slot == ALGOT_SLOT_ZONED)
+            algot_fifo_add(&nd->zone_fifo, pos, rq);
+        else
+            algot_fifo_add(&nd->fifo[dir], pos, rq);
+    }
+
+    if (ref == ALGOT_SLOT_ZONED)
+        algot_zone_del(nd, next);
+    else if (ref != ALGOT_SLOT_UNSORTED && ref != ALGOT_SLOT_NONE)
+    {
+        elv_rb_del(&nd->sort_queue[dir], next);
+        nd->nsorted[dir] -= 1;
+        algot_group_window(next, -1);
+
+        if (ref != ALGOT_SLOT_SORTED)
+        {
+            BUG_ON(ref >= nd->win_cap);
+            nd->win.cur.sorted[ref] = ALGOT_REF_MERGED;
+            nd->stats.merged++;
+            algot_holes(nd, 1);
+        }
+        algot_forget(nd, next);
+    }
+    else if (ref == ALGOT_SLOT_UNSORTED)
+    {
+        elv_rb_del(&nd->wait_sort[dir], next);
+        algot_count_wait(nd, next, -1);
+    }
+    if (ref != ALGOT_SLOT_NONE)
+        algot_group_queue(nd, next, false);
+    list_del_init(&next->queuelist);
+    algot_rq(next)->slot = ALGOT_SLOT_NONE;
+    elv_rqhash_del(q, next);
+    if (q->last_merge == next)
+        q->last_merge = NULL;
+}
+
+/* A request of ours starting where bio ends, called with nd->lock held */
+static int algot_request_merge(struct request_queue *q, struct request **req,
+                 struct bio *bio)
+{
+    struct algot_data *nd = q->elevator->elevator_data;
+    sector_t sector = bio_end_sector(bio);
+    int dir = bio_data_dir(bio);
+    struct request *rq;
+
+    if (!nd->front_merges)
+        return ELEVATOR_NO_MERGE;
+
+    rq = elv_rb_find(&nd->sort_queue[dir], sector);
+    if (!rq)
+        rq = elv_rb_find(&nd->wait_sort[dir], sector);
+    if (!rq && dir == WRITE)
+        rq = elv_rb_find(&nd->zone_sort, sector);
+    if (rq && elv_bio_merge_ok(rq, bio))
+    {
+        *req = rq;
+        if (blk_discard_mergable(rq))
+            return ELEVATOR_DISCARD_MERGE;
+        return ELEVATOR_FRONT_MERGE;
+    }
+    return ELEVATOR_NO_MERGE;
+}
+
+/* Only requests still queued here may grow, not ones on their way out */
+static bool algot_allow_merge(struct request_queue *q, struct request *rq,
+                 struct bio *bio)
+{
+    return algot_rq(rq)->slot != ALGOT_SLOT_NONE;
+}
+
+/* Called with nd->lock held */
+static void algot_request_merged(struct request_queue *q, struct request *rq,
+                 enum elv_merge type)
+{
+    struct algot_data *nd = q->elevator->elevator_data;
+    unsigned int ref = algot_rq(rq)->slot;
+    int dir = rq_data_dir(rq);
+
+    if (type == ELEVATOR_DISCARD_MERGE)
+    {
+        nd->stats.discard_merges++;
+        return;
+    }
+    if (type != ELEVATOR_FRONT_MERGE)
+    {
+        nd->stats.back_merges++;
+        return;
+    }
+    nd->stats.front_merges++;
+
+    /* A front merge moves the request, keep it ordered where it is */
+    if (ref == ALGOT_SLOT_UNSORTED)
+    {
+        elv_rb_del(&nd->wait_sort[dir], rq);
+        elv_rb_add(&nd->wait_sort[dir], rq);
+    }
+    else if (ref == ALGOT_SLOT_ZONED)
+    {
+        /* Never past the zone start, but maybe now ahead of its first */
+        elv_rb_del(&nd->zone_sort, rq);
+        elv_rb_add(&nd->zone_sort, rq);
+        if (list_empty(&algot_rq(rq)->zone))
+            algot_zone_link(nd, rq);
+    }
+    else if (ref != ALGOT_SLOT_NONE)
+    {
+        elv_rb_del(&nd->sort_queue[dir], rq);
+        elv_rb_add(&nd->sort_queue[dir], rq);
+        algot_rq(rq)->moved = true;
+        if (dir == nd->dir)
+        {
+            nd->dirty += 1;
+            nd->redo = true;
+        }
+    }
+}
+
+/* Called with nd->lock held */
+static void algot_add_request(struct request_queue *q, struct request *rq)
+{
+    struct algot_data *nd = q->elevator->elevator_data;
+    struct algot_icq *ic = algot_stream(rq);
+    int dir = rq_data_dir(rq);
+
+    if (rq_mergeable(rq))
+    {
+        elv_rqhash_add(q, rq);
+        if (!q->last_merge)
+            q->last_merge = rq;
+    }
+    algot_rq(rq)->deadline = jiffies + nd->fifo_expire[dir];
+    nd->busy = jiffies;
+    if (algot_class(rq) != IOPRIO_CLASS_IDLE)
+        nd->fg_busy = jiffies;
+    algot_group_queue(nd, rq, true);
+    /* A read requeued came in before, it is no new read of its stream */
+    if (ic && algot_rq(rq)->ic)
+        ic->st.queued++;
+    else if (ic)
+    {
+        algot_think(ic, rq);
+        if (ic == nd->antic && !nd->antic_rq)
+        {
+            nd->antic_rq = rq;
+            nd->stats.antic_hits++;
+            hrtimer_try_to_cancel(&nd->antic_timer);
+        }
+    }
+    algot_rq(rq)->ic = ic;
+
+    /* The plan would reorder writes a zone write lock keeps in order */
+    if (algot_zoned(nd) && blk_req_needs_zone_write_lock(rq))
+    {
+        algot_zone_add(nd, rq);
+        algot_log(nd, "add %llu write zoned", (unsigned long long)blk_rq_pos(rq));
+        return;
+    }
+
+    while (!list_empty(&nd->wait_queue[dir]) && nd->nsorted[dir] < nd->win_cap)
+    {
+        struct request *req = algot_admit(nd, dir);
+        if (!req)
+            break;
+        algot_unwait(nd, req);
+        algot_sort_in(nd, req);
+    }
+
+    /* Room left means nothing but idle class requests held back waits */
+    if (nd->nsorted[dir] < nd->win_cap &&
+        (algot_class(rq) != IOPRIO_CLASS_IDLE || algot_quiet(nd)))
+        algot_sort_in(nd, rq);
+    else
+    {
+        algot_wait(nd, rq);
+        if (nd->nsorted[dir] >= nd->win_cap && nd->win_cap < nd->calc_max)
+            kblockd_mod_delayed_work_on(WORK_CPU_UNBOUND, &nd->resize_work, 0);
+    }
+    algot_log(nd, "add %llu %s%s", (unsigned long long)blk_rq_pos(rq),
+              dir == WRITE ? "write" : "read",
+              algot_rq(rq)->slot == ALGOT_SLOT_UNSORTED ? " waiting" : "");
+}
+
+/* Called with nd->lock held, requests merged away are put on free */
+static void algot_insert(struct request_queue *q, struct algot_data *nd,
+                 struct list_head *list, blk_insert_t flags,
+                 struct list_head *free)
+{
+    while (!list_empty(list))
+    {
+        struct request *rq = list_first_entry(list, struct request, queuelist);
+        list_del_init(&rq->queuelist);
+
+        /* A zoned write requeued gives its zone back until issued again */
+        blk_req_zone_write_unlock(rq);
+
+        /* Left without ours, rq is neither merged nor queued here */
+        if (algot_rq(rq) && blk_mq_sched_try_insert_merge(q, rq, free))
+            continue;
+
+        trace_block_rq_insert(rq);
+
+        if (!algot_rq(rq) || (flags & BLK_MQ_INSERT_AT_HEAD) ||
+            blk_rq_is_passthrough(rq))
+        {
+            if (algot_rq(rq))
+                algot_rq(rq)->slot = ALGOT_SLOT_NONE;
+            else
+                nd->stats.unkept++;
+            if (flags & BLK_MQ_INSERT_AT_HEAD)
+                list_add(&rq->queuelist, &nd->dispatch);
+            else
+                list_add_tail(&rq->queuelist, &nd->dispatch);
+        }
+        else
+            algot_add_request(q, rq);
+    }
+}
+
+/* Insert what other CPUs staged meanwhile, called with nd->lock held */
+static void algot_drain(struct request_queue *q, struct algot_data *nd,
+                 struct list_head *free)
+{
+    struct blk_mq_hw_ctx *hctx;
+    struct algot_stage *st;
+    unsigned long i;
+    LIST_HEAD(list);
+
+    queue_for_each_hw_ctx(q, hctx, i)
+    {
+        st = hctx->sched_data;
+        if (list_empty_careful(&st->list))
+            continue;
+        spin_lock(&st->lock);
+        list_splice_tail_init(&st->list, &list);
+        spin_unlock(&st->lock);
+    }
+    if (list_empty(&list))
+        return;
+    nd->stats.staged += list_count_nodes(&list);
+    algot_insert(q, nd, &list, 0, free);
+}
+
+static void algot_insert_requests(struct blk_mq_hw_ctx *hctx,
+                 struct list_head *list, blk_insert_t flags)
+{
+    struct request_queue *q = hctx->queue;
+    struct algot_data *nd = q->elevator->elevator_data;
+    struct algot_stage *st = hctx->sched_data;
+    LIST_HEAD(free);
+
+    /* Leave it to the lock holder rather than queue up behind it */
+    if (!(flags & BLK_MQ_INSERT_AT_HEAD) && !spin_trylock(&nd->lock))
+    {
+        spin_lock(&st->lock);
+        list_splice_tail_init(list, &st->list);
+        spin_unlock(&st->lock);
+        return;
+    }
+    if (flags & BLK_MQ_INSERT_AT_HEAD)
+        spin_lock(&nd->lock);
+
+    algot_insert(q, nd, list, flags, &free);
+    algot_drain(q, nd, &free);
+    spin_unlock(&nd->lock);
+
+    blk_mq_free_requests(&free);
+}
+
+static bool algot_bio_merge(struct request_queue *q, struct bio *bio,
+                 unsigned int nr_segs)
+{
+    struct algot_data *nd = q->elevator->elevator_data;
+    struct request *free = NULL;
+    bool ret;
+
+    spin_lock(&nd->lock);
+    ret = blk_mq_sched_try_merge(q, bio, nr_segs, &free);
+    spin_unlock(&nd->lock);
+
+    if (free)
+        blk_mq_free_request(free);
+
+    return ret;
+}
+
+/* Put req at idx of the new order, remembering where it was in the last one */
+static inline void
+algot_place(struct algot_data *nd, struct request *req, unsigned int idx)
+{
+    struct algot_rq *m = algot_rq(req);
+
+    if (nd->incremental && m->slot != ALGOT_SLOT_SORTED && !m->moved)
+        algot_link(&nd->win.next, idx, req, m->slot);
+    else
+        algot_link(&nd->win.next, idx, req, ALGOT_IDX_NEW);
+    m->next_slot = idx;
+    m->moved = false;
+}
+
+/* How many requests the next plan covers, out of ns sorted */
+static unsigned int algot_width(struct algot_data *nd, unsigned int ns)
+{
+    unsigned int width;
+
+    if (ns <= nd->greedy_max || nd->rot.nz || !nd->program_budget)
+        return ns;
+    width = algot_budget_width((u64)nd->program_budget * NSEC_PER_USEC,
+                               nd->cell_cost);
+    width = max_t(unsigned int, width, ALGOT_CALC_MIN);
+    if (width >= ns)
+        return ns;
+    nd->stats.bounded++;
+    return width;
+}
+
+/*
+ * Lay the c-scan order of the sort_queue of the current batch out in
+ *  win.next, by member depth under stripe_aware, and fill its position
+ *  arrays.  A plan narrower than sort_queue takes the requests nearest
+ *  the head on either side.  Called with nd->lock held.
+ */
+static void algot_prepare_plan(struct algot_data *nd)
+{
+    struct algot_plan *w = &nd->win.next;
+    int dir = nd->dir;
+    struct rb_root *root = &nd->sort_queue[dir];
+    sector_t rw_head = algot_head(nd);
+    unsigned int idx = 0;
+    struct rb_node *node, *start = NULL, *fwd, *bwd;
+    unsigned int nf = 0;
+    struct request *req;
+
+    while (!list_empty(&nd->wait_queue[dir]) && nd->nsorted[dir] < nd->win_cap)
+    {
+        req = algot_admit(nd, dir);
+        if (!req)
+            break;
+        algot_unwait(nd, req);
+        algot_sort_in(nd, req);
+    }
+
+    w->ns = algot_width(nd, nd->nsorted[dir]);
+    w->greedy = w->ns <= nd->greedy_max;
+    w->dir = dir;
+    w->model = nd->model;
+    w->rot = nd->rot;
+    w->stripe.chunk = nd->stripe.chunk;
+    w->stripe.width = algot_striped(nd) ? nd->stripe.width : 0;
+    w->xfer_cost = nd->xfer_cost;
+    w->size_weight = nd->size_weight;
+    w->rt_weight = nd->rt_weight;
+
+    /* Find the first request after the head, c-scan starts from there */
+    node = root->rb_node;
+    while (node)
+    {
+        if (blk_rq_pos(rb_entry_rq(node)) > rw_head)
+        {
+            start = node;
+            node = node->rb_left;
+        }
+        else
+            node = node->rb_right;
+    }
+
+    /* Ahead of the head or behind it, whichever is nearer */
+    fwd = start;
+    bwd = start ? rb_prev(start) : rb_last(root);
+    while (idx < w->ns)
+    {
+        if (fwd && (!bwd || blk_rq_pos(rb_entry_rq(fwd)) - rw_head <=
+                            rw_head - blk_rq_pos(rb_entry_rq(bwd))))
+        {
+            fwd = rb_next(fwd);
+            nf++;
+        }
+        else
+            bwd = rb_prev(bwd);
+        idx++;
+    }
+
+    for (idx = 0, node = start; idx < nf; node = rb_next(node))
+        w->sorted[idx++] = rb_entry_rq(node);
+    for (node = bwd ? rb_next(bwd) : rb_first(root); idx < w->ns; node = rb_next(node))
+        w->sorted[idx++] = rb_entry_rq(node);
+    algot_stripe_order(w, rw_head);
+    for (idx = 0; idx < w->ns; idx++)
+        algot_place(nd, w->sorted[idx], idx);
+
+    algot_lay_out(w, nd->narrow_matrix);
+    nd->dirty = 0;
+    nd->redo = false;
+    nd->gate_shift = 0;
+}
+
+/*
+ * Move dirty_limit by what calculating win.next in spent ns bought, as
+ *  algot_saving() has it.  A seek model in us makes that comparable with
+ *  spent, without one any saving counts.  Plans worth their time halve
+ *  the limit, others raise it by one, up to calc_max.  Called with
+ *  nd->lock held, before win.next is installed.
+ */
+static void algot_adapt(struct algot_data *nd, u64 spent)
+{
+    struct algot_plan *p = &nd->win.next;
+    int limit = nd->dirty_limit;
+    sector_t saved;
+    bool worth;
+
+    if (!algot_saving(&nd->win.cur, nd->opt_s, nd->opt_e, p, algot_head(nd),
+                      &saved))
+        return;
+
+    if (p->model.n)
+        worth = saved > div_u64(spent, NSEC_PER_USEC);
+    else
+        worth = saved > 0;
+
+    if (worth)
+        limit = max(limit / 2, 1);
+    else
+    {
+        limit = min_t(int, limit + 1, nd->calc_max);
+        nd->stats.futile++;
+    }
+    if (nd->dirty >= nd->dirty_limit)
+        nd->dirty = limit;
+    nd->dirty_limit = limit;
+}
+
+/*
+ * Start serving from win.next, calculated since start, of which filling
+ *  cells of the matrix took spent ns.  Called with nd->lock held.
+ */
+static void algot_install(struct algot_data *nd, u64 start,
+                          unsigned long cells, u64 spent)
+{
+    struct algot_window *w = &nd->win;
+    bool stale = w->next.dir != nd->dir;
+    unsigned int holes = 0;
+    struct request *rq;
+    unsigned int i;
+
+    /* What the old plan has and a narrower new one leaves out */
+    for (i = nd->opt_s; !stale && i <= nd->opt_e; i++)
+    {
+        rq = w->cur.sorted[i];
+        if (rq != ALGOT_REF_MERGED && algot_rq(rq)->next_slot == ALGOT_SLOT_NONE)
+            algot_rq(rq)->slot = ALGOT_SLOT_SORTED;
+    }
+
+    for (i = 0; i < w->next.ns; i++)
+    {
+        rq = w->next.sorted[i];
+        if (rq == ALGOT_REF_MERGED)
+        {
+            holes++;    // left while the plan was calculated
+            continue;
+        }
+        if (!stale)
+            algot_rq(rq)->slot = i;
+        algot_rq(rq)->next_slot = ALGOT_SLOT_NONE;
+    }
+
+    nd->stats.programs++;
+    nd->stats.program_ns += ktime_get_ns() - start;
+    nd->stats.program_reqs += w->next.ns;
+    if (w->next.greedy)
+        nd->stats.greedy++;
+    nd->cell_cost = algot_cell_cost(nd->cell_cost, cells, spent);
+    algot_log(nd, "program %s %u%s", w->next.dir == WRITE ? "write" : "read",
+              w->next.ns, stale ? " stale" : "");
+
+    /* The batch changed direction while the plan was calculated */
+    if (stale)
+        return;
+    if (nd->adapt_dirty)
+        algot_adapt(nd, ktime_get_ns() - start);
+
+    swap(w->cur, w->next);
+    /* What came in meanwhile was gated against the old plan */
+    if (nd->dirty)
+        nd->redo = true;
+    nd->opt_s = 0;
+    nd->opt_e = w->cur.ns-1;
+    if (!w->cur.ns)
+    {
+        nd->opt_s = 1;
+        nd->opt_e = 0;
+    }
+    nd->holes = 0;
+    algot_holes(nd, holes);
+}
+
+static inline void algot_program(struct request_queue *q, struct algot_data *nd)
+{
+    u64 start = ktime_get_ns(), solve;
+    unsigned long cells;
+
+    algot_prepare_plan(nd);
+    solve = ktime_get_ns();
+    cells = algot_solve(&nd->win.next, &nd->win.cur);
+    algot_install(nd, start, cells, ktime_get_ns() - solve);
+}
+
+static void algot_rebuild_work(struct work_struct *work)
+{
+    struct algot_data *nd = container_of(work, struct algot_data, rebuild_work);
+    u64 start = ktime_get_ns(), solve;
+    unsigned long cells;
+
+    spin_lock(&nd->lock);
+    algot_prepare_plan(nd);
+    spin_unlock(&nd->lock);
+
+    /* Only reads win.cur, which nothing but algot_install() replaces */
+    solve = ktime_get_ns();
+    cells = algot_solve(&nd->win.next, &nd->win.cur);
+    solve = ktime_get_ns() - solve;
+
+    spin_lock(&nd->lock);
+    algot_install(nd, start, cells, solve);
+    nd->rebuilding = false;
+    spin_unlock(&nd->lock);
+
+    /* Dispatch may have found the old plan used up and given up */
+    blk_mq_run_hw_queues(nd->queue, true);
+}
+
+/* Take rq out of the scheduler to dispatch it, called with nd->lock held */
+static void algot_take(struct request_queue *q, struct algot_data *nd,
+                 struct request *rq)
+{
+    struct algot_icq *ic = algot_icq(rq);
+    int dir = rq_data_dir(rq);
+
+    if (algot_rq(rq)->slot == ALGOT_SLOT_ZONED)
+        algot_zone_del(nd, rq);
+    else if (algot_rq(rq)->slot != ALGOT_SLOT_UNSORTED)
+    {
+        elv_rb_del(&nd->sort_queue[dir], rq);
+        nd->nsorted[dir]--;
+        algot_group_window(rq, -1);
+        algot_forget(nd, rq);
+        list_del_init(&rq->queuelist);
+    }
+    else
+        algot_unwait(nd, rq);
+    algot_group_queue(nd, rq, false);
+    algot_rq(rq)->slot = ALGOT_SLOT_NONE;
+    if (algot_class(rq) != IOPRIO_CLASS_IDLE)
+        nd->fg_busy = jiffies;
+
+    nd->stats.head_travel += algot_dist(nd->rw_head, blk_rq_pos(rq));
+    algot_log(nd, "dispatch %llu %s", (unsigned long long)blk_rq_pos(rq),
+              dir == WRITE ? "write" : "read");
+    nd->rw_head = blk_rq_pos(rq);
+    nd->rw_end = blk_rq_pos(rq) + blk_rq_sectors(rq);
+
+    /*
+     * Wait for the next read of a stream once this one is done, unless
+     *  fifo_batch of them went in a row: the plan takes its turn before
+     *  the next one is there, or it would pick that first, next to the
+     *  head.  While a stream is waited for, only expiry gets anything else
+     *  through, and that leaves the wait and the run in place.
+     */
+    if (ic)
+        ic->st.queued--;
+    if (!nd->antic || rq == nd->antic_rq)
+    {
+        nd->antic_run = rq == nd->antic_rq ? nd->antic_run + 1 : 0;
+        nd->antic = NULL;
+        nd->antic_rq = NULL;
+    }
+    if (!nd->antic && ic && nd->antic_run < nd->fifo_batch &&
+        algot_stream_on(&ic->st, nd->antic_expire))
+    {
+        nd->antic = ic;
+        WRITE_ONCE(nd->antic_until, U64_MAX);
+        nd->stats.antic++;
+    }
+
+    elv_rqhash_del(q, rq);
+    if (q->last_merge == rq)
+        q->last_merge = NULL;
+
+    /* Emptied, give the window back unless work comes in meanwhile */
+    if (nd->win_cap > ALGOT_CALC_MIN && !algot_queued(nd, READ) &&
+        !algot_queued(nd, WRITE))
+        kblockd_mod_delayed_work_on(WORK_CPU_UNBOUND, &nd->resize_work,
+                                    ALGOT_IDLE_RELEASE);
+}
+
+/*
+ * Where the head will be going round when the next request reaches the
+ *  disk: right at the end of the last dispatched one while it is still
+ *  being served, otherwise as far past it as the time since it completed.
+ */
+static u32 algot_head_angle(struct algot_data *nd)
+{
+    const struct algot_rotation *r = &nd->win.cur.rot;
+    u32 ang = algot_angle(r, nd->rw_end);
+    u64 idle;
+    u32 rem;
+
+    if (READ_ONCE(nd->done_pos) != nd->rw_head)
+        return ang;
+    idle = div_u64(ktime_get_ns() - READ_ONCE(nd->done_ns), NSEC_PER_USEC);
+    div_u64_rem(ang + idle, r->rev, &rem);
+    return rem;
+}
+
+/* Returns NULL once the plan in use is used up */
+static inline struct request *
+pick_opt(struct request_queue *q, struct algot_data* nd)
+{
+    struct algot_plan *p = &nd->win.cur;
+    struct request** sorted = p->sorted;
+    unsigned int s = nd->opt_s;
+    unsigned int e = nd->opt_e;
+    unsigned int i;
+    struct request* rq;
+
+    /* The tombstones trimmed off are behind the head, no longer holes */
+    if (!algot_trim(p, &s, &e))
+    {
+        algot_unhole(nd, s - nd->opt_s);
+        nd->opt_s = s;
+        return NULL;
+    }
+    algot_unhole(nd, s - nd->opt_s + nd->opt_e - e);
+
+    if (p->rot.nz)
+    {
+        i = algot_satf(p, s, e, nd->rw_end, algot_head_angle(nd));
+        if (i == s)
+        {
+            s++;
+            nd->stats.picks_left++;
+        }
+        else if (i == e)
+        {
+            e--;
+            nd->stats.picks_right++;
+        }
+        else
+            nd->stats.picks_inner++;
+    }
+    else if (s == e)
+        i = s++;
+    else if (algot_side(p, s, e, algot_head(nd)))
+    {
+        i = s++;
+        nd->stats.picks_left++;
+    }
+    else
+    {
+        i = e--;
+        nd->stats.picks_right++;
+    }
+    nd->opt_s = s;
+    nd->opt_e = e;
+
+    rq = sorted[i];
+    if (rq == ALGOT_REF_DISPATCHED)
+        BUG();
+
+    /* Taken from inside the interval it leaves a tombstone */
+    if (i < s || i > e)
+        sorted[i] = ALGOT_REF_DISPATCHED;
+    else
+    {
+        sorted[i] = ALGOT_REF_MERGED;
+        nd->holes++;    // only under rotation, which has no matrix to compact
+    }
+    nd->stats.dispatched++;
+    if (nd->dirty && !nd->redo)
+        algot_passing(nd, rq);
+    algot_take(q, nd, rq);
+    return rq;
+}
+
+/*
+ * The oldest queued request, if it has waited past its expiry, reads
+ *  first.  fifo and wait_queue are both in arrival order.  Called with
+ *  nd->lock held.
+ */
+static struct request *algot_expired(struct algot_data *nd)
+{
+    struct request *rq, *w;
+    int dir;
+
+    for (dir = READ; dir <= WRITE; dir++)
+    {
+        rq = NULL;
+        if (!list_empty(&nd->fifo[dir]))
+            rq = list_first_entry(&nd->fifo[dir], struct request, queuelist);
+        if (!list_empty(&nd->wait_queue[dir]))
+        {
+            w = list_first_entry(&nd->wait_queue[dir], struct request, queuelist);
+            if (!rq || time_before(algot_rq(w)->deadline,
+                                   algot_rq(rq)->deadline))
+                rq = w;
+        }
+        if (dir == WRITE && !list_empty(&nd->zone_fifo))
+        {
+            w = list_first_entry(&nd->zone_fifo, struct request, queuelist);
+            if (!rq || time_before(algot_rq(w)->deadline,
+                                   algot_rq(rq)->deadline))
+                rq = w;
+        }
+
+        if (rq && time_after_eq(jiffies, algot_rq(rq)->deadline))
+            return rq;
+    }
+    return NULL;
+}
+
+/* Let go of the plan in use, called with nd->lock held */
+static void algot_drop_plan(struct algot_data *nd)
+{
+    struct request **sorted = nd->win.cur.sorted;
+    unsigned int i;
+
+    for (i = nd->opt_s; i <= nd->opt_e; i++)
+    {
+        if (sorted[i] != ALGOT_REF_MERGED)
+            algot_rq(sorted[i])->slot = ALGOT_SLOT_SORTED;
+    }
+    nd->opt_s = 1;
+    nd->opt_e = 0;
+    algot_redo(nd);
+}
+
+/*
+ * Choose the direction of the next batch: reads, unless writes have been
+ *  passed over writes_starved times already.  Sweeps of one direction are
+ *  never interleaved with the other, switching drops the plan.  Called
+ *  with nd->lock held.
+ */
+static void algot_start_batch(struct algot_data *nd)
+{
+    bool reads = algot_ready(nd, READ);
+    bool writes = algot_ready(nd, WRITE);
+    int dir;
+
+    if (reads && (!writes || nd->starved < nd->writes_starved))
+    {
+        if (writes)
+            nd->starved++;
+        dir = READ;
+    }
+    else
+    {
+        nd->starved = 0;
+        dir = WRITE;
+    }
+
+    nd->batched = 0;
+    if (dir != nd->dir)
+    {
+        algot_drop_plan(nd);
+        nd->dir = dir;
+    }
+}
+
+/*
+ * Whether the plan in use has to be calculated again before the next
+ *  pick: once dirty_limit requests came in, unless plan_gate finds they
+ *  cannot change the first move.  That takes each of them to sit between
+ *  live neighbours, them all to move the costs of the two first moves
+ *  less than those lie apart, and fewer of them than a quarter of what
+ *  is left of the plan.  Called with nd->lock held.
+ */
+static bool algot_stale(struct algot_data *nd)
+{
+    struct algot_plan *p = &nd->win.cur;
+    unsigned int s = nd->opt_s, e = nd->opt_e;
+    sector_t head, left, right;
+
+    if (nd->dirty < nd->dirty_limit)
+        return false;
+    if (nd->redo || !nd->plan_gate || !algot_trim(p, &s, &e) || s == e ||
+        nd->dirty * ALGOT_HOLE_SHARE > e - s + 1)
+        return true;
+
+    head = algot_head(nd);
+    left = algot_first(p, s, e, head, true);
+    right = algot_first(p, s, e, head, false);
+    return (left > right ? left - right : right - left) <= nd->gate_shift;
+}
+
+/*
+ * Recalculate a dirty plan, in rebuild_work when async_rebuild is set and
+ *  the old plan still has requests to serve meanwhile.  Requests past
+ *  their expiry bypass the plan, and so does the next read of a stream
+ *  waited for, which it is NULL until.  Called with nd->lock held.
+ */
+static struct request *algot_pick(struct request_queue *q, struct algot_data *nd)
+{
+    struct request *rq;
+    unsigned int ref;
+
+    /*
+     * An overdue request goes first.  The cells of the plan do not depend
+     *  on the head, the plan goes on from where it leaves it.
+     */
+    rq = algot_expired(nd);
+    if (rq && algot_rq(rq)->slot == ALGOT_SLOT_ZONED)
+    {
+        /* Only with the writes of its zone before it */
+        rq = algot_zone_first(nd, rq);
+        if (!blk_req_can_dispatch_to_zone(rq))
+            rq = NULL;
+    }
+    if (rq)
+    {
+        /* Out of the plan it leaves a tombstone, like a merge */
+        ref = algot_rq(rq)->slot;
+        if (ref != ALGOT_SLOT_SORTED && ref != ALGOT_SLOT_UNSORTED &&
+            ref != ALGOT_SLOT_ZONED)
+        {
+            nd->win.cur.sorted[ref] = ALGOT_REF_MERGED;
+            algot_holes(nd, 1);
+        }
+        if (nd->dirty && !nd->redo && ref != ALGOT_SLOT_UNSORTED &&
+            ref != ALGOT_SLOT_ZONED && rq_data_dir(rq) == nd->dir)
+            algot_passing(nd, rq);
+        nd->stats.expired++;
+        algot_log(nd, "expired %llu", (unsigned long long)blk_rq_pos(rq));
+        algot_take(q, nd, rq);
+        return rq;
+    }
+
+    /* The stream waited for reads on first, fifo_batch reads in a row */
+    if (nd->antic_rq && nd->antic_run < nd->fifo_batch)
+    {
+        rq = nd->antic_rq;
+        ref = algot_rq(rq)->slot;
+        if (ref != ALGOT_SLOT_SORTED && ref != ALGOT_SLOT_UNSORTED)
+        {
+            nd->win.cur.sorted[ref] = ALGOT_REF_MERGED;
+            algot_holes(nd, 1);
+        }
+        if (nd->dirty && !nd->redo)
+            algot_passing(nd, rq);
+        algot_take(q, nd, rq);
+        nd->batched++;
+        return rq;
+    }
+    if (nd->antic && !nd->antic_rq)
+    {
+        if (ktime_get_ns() < READ_ONCE(nd->antic_until))
+            return NULL;
+        nd->antic = NULL;
+        nd->stats.antic_misses++;
+    }
+
+    if (nd->batched >= nd->fifo_batch || !algot_ready(nd, nd->dir))
+        algot_start_batch(nd);
+
+    /* Writes to sequential zones go in zone order, ahead of the plan */
+    if (nd->dir == WRITE && !list_empty(&nd->zone_fifo))
+    {
+        rq = algot_zone_write(nd);
+        if (rq)
+        {
+            algot_take(q, nd, rq);
+            nd->batched++;
+            return rq;
+        }
+        /* Every zone written to is busy, plan the rest meanwhile */
+        if (RB_EMPTY_ROOT(&nd->sort_queue[WRITE]))
+        {
+            if (!algot_ready(nd, READ))
+                return NULL;
+            algot_drop_plan(nd);
+            nd->dir = READ;
+            nd->batched = 0;
+        }
+    }
+
+    if (nd->dirty >= nd->dirty_limit && !nd->rebuilding)
+    {
+        if (!algot_stale(nd))
+            nd->stats.gated++;
+        else if (nd->async_rebuild && nd->opt_s <= nd->opt_e)
+        {
+            nd->rebuilding = true;
+            kblockd_schedule_work(&nd->rebuild_work);
+        }
+        else
+            algot_program(q, nd);
+    }
+
+    rq = pick_opt(q, nd);
+    if (!rq && !nd->rebuilding)
+    {
+        /* Plan drained, recalculate with whatever is pending */
+        algot_program(q, nd);
+        rq = pick_opt(q, nd);
+    }
+    if (rq)
+        nd->batched++;
+    return rq;
+}
+
+/*
+ * Follow rq, just picked, with up to dispatch_batch-1 more requests of the
+ *  plan in use onto ready, while it still stands.  Called with nd->lock
+ *  held.
+ */
+static void algot_batch(struct request_queue *q, struct algot_data *nd)
+{
+    unsigned int n = min(nd->dispatch_batch, blk_queue_depth(q));
+    unsigned int depth = READ_ONCE(nd->depth);
+    struct request *rq;
+    LIST_HEAD(list);
+
+    if (depth)
+        n = min(n, depth);
+
+    while (--n > 0 && nd->batched < nd->fifo_batch &&
+           !algot_stale(nd) && !nd->antic && !algot_expired(nd))
+    {
+        rq = pick_opt(q, nd);
+        if (!rq)
+            break;
+        nd->batched++;
+        nd->stats.readied++;
+        list_add_tail(&rq->queuelist, &list);
+    }
+    if (list_empty(&list))
+        return;
+
+    spin_lock(&nd->ready_lock);
+    list_splice_tail(&list, &nd->ready);
+    spin_unlock(&nd->ready_lock);
+}
+
+/*
+ * Whether as many requests are in flight as the device gets, the
+ *  completion of one then runs the queue again.  Requests bypassing the
+ *  optimiser are never held back.
+ */
+static bool algot_throttle(struct algot_data *nd)
+{
+    unsigned int depth = READ_ONCE(nd->depth);
+
+    if (!depth || atomic_read(&nd->inflight) < depth ||
+        !list_empty_careful(&nd->dispatch))
+        return false;
+
+    WRITE_ONCE(nd->limited, true);
+    WRITE_ONCE(nd->throttled, true);
+    /* Pairs with the barrier in algot_done() */
+    smp_mb();
+    return atomic_read(&nd->inflight) >= depth;
+}
+
+/* Hand rq to the driver, it is in flight until it completes */
+static inline void algot_issue(struct algot_data *nd, struct request *rq)
+{
+    struct algot_rq *m = algot_rq(rq);
+
+    rq->rq_flags |= RQF_STARTED;
+    /* Without ours to note it in, it is not counted in flight */
+    if (m)
+    {
+        m->next_slot = ALGOT_SLOT_ISSUED;
+        m->issued = ktime_get_ns();
+        atomic_inc(&nd->inflight);
+    }
+    blk_req_zone_write_lock(rq);
+}
+
+/* The first request algot_batch() readied, if any */
+static struct request *algot_unready(struct algot_data *nd)
+{
+    struct request *rq;
+
+    spin_lock(&nd->ready_lock);
+    rq = list_first_entry_or_null(&nd->ready, struct request, queuelist);
+    if (rq)
+        list_del_init(&rq->queuelist);
+    spin_unlock(&nd->ready_lock);
+    return rq;
+}
+
+static struct request *algot_dispatch_request(struct blk_mq_hw_ctx *hctx)
+{
+    struct request_queue *q = hctx->queue;
+    struct algot_data *nd = q->elevator->elevator_data;
+    struct request *rq = NULL;
+    unsigned long held = 0;
+    LIST_HEAD(free);
+
+    if (algot_throttle(nd))
+    {
+        spin_lock(&nd->lock);
+        nd->stats.throttled++;
+        spin_unlock(&nd->lock);
+        return NULL;
+    }
+
+    /*
+     * Requests bypassing the optimiser go first, as in mq-deadline, then
+     *  what the last call took off the plan, without nd->lock when there
+     *  are none.
+     */
+    if (list_empty_careful(&nd->dispatch) && !list_empty_careful(&nd->ready))
+    {
+        rq = algot_unready(nd);
+        if (rq)
+        {
+            algot_issue(nd, rq);
+            return rq;
+        }
+    }
+
+    spin_lock(&nd->lock);
+    algot_drain(q, nd, &free);
+    if (!list_empty(&nd->dispatch))
+    {
+        rq = list_first_entry(&nd->dispatch, struct request, queuelist);
+        list_del_init(&rq->queuelist);
+    }
+    else if (!list_empty_careful(&nd->ready))
+        rq = algot_unready(nd);
+    if (!rq && (algot_queued(nd, READ) || algot_queued(nd, WRITE)))
+    {
+        rq = algot_pick(q, nd);
+        if (rq && nd->dispatch_batch > 1)
+            algot_batch(q, nd);
+    }
+    if (rq)
+        algot_issue(nd, rq);
+    else
+        held = algot_held(nd);
+    spin_unlock(&nd->lock);
+
+    /* Come back once idle class requests may go */
+    if (held)
+        blk_mq_delay_run_hw_queues(q, jiffies_to_msecs(held));
+    blk_mq_free_requests(&free);
+    return rq;
+}
+
+static bool algot_has_work(struct blk_mq_hw_ctx *hctx)
+{
+    struct algot_data *nd = hctx->queue->elevator->elevator_data;
+    struct blk_mq_hw_ctx *h;
+    struct algot_stage *st;
+    unsigned long i;
+
+    queue_for_each_hw_ctx(hctx->queue, h, i)
+    {
+        st = h->sched_data;
+        if (!list_empty_careful(&st->list))
+            return true;
+    }
+
+    return !list_empty_careful(&nd->dispatch) ||
+        !list_empty_careful(&nd->ready) ||
+        !RB_EMPTY_ROOT(&nd->sort_queue[READ]) ||
+        !RB_EMPTY_ROOT(&nd->sort_queue[WRITE]) ||
+        !list_empty_careful(&nd->wait_queue[READ]) ||
+        !list_empty_careful(&nd->wait_queue[WRITE]) ||
+        !list_empty_careful(&nd->zone_fifo);
+}
+
+/*
+ * Keep async requests and writes from taking all the tags, otherwise
+ *  synchronous reads cannot even get into sort_queue to be optimised.
+ */
+static void algot_limit_depth(blk_opf_t opf, struct blk_mq_alloc_data *data)
+{
+    struct algot_data *nd = data->q->elevator->elevator_data;
+
+    if (op_is_sync(opf) && !op_is_write(opf))
+        return;
+
+    data->shallow_depth = nd->async_depth;
+}
+
+/*
+ * How many struct algot_rq the pool holds in reserve: a queue depth, or
+ *  on a zoned queue as many requests as all its hardware queues can
+ *  ever hold.  A write to a sequential zone left without one would go
+ *  out of zone order, with that reserve every request gets one.
+ */
+static unsigned int algot_reserve(struct algot_data *nd)
+{
+    struct request_queue *q = nd->queue;
+
+    if (algot_zoned(nd))
+        return MAX_SCHED_RQ * q->nr_hw_queues;
+    return q->nr_requests;
+}
+
+static void algot_depth_updated(struct blk_mq_hw_ctx *hctx)
+{
+    struct request_queue *q = hctx->queue;
+    struct algot_data *nd = q->elevator->elevator_data;
+    struct blk_mq_tags *tags = hctx->sched_tags;
+
+    nd->async_depth = max(1UL, 3 * q->nr_requests / 4);
+
+    sbitmap_queue_min_shallow_depth(&tags->bitmap_tags, nd->async_depth);
+
+    /*
+     * A zoned queue's reserve covers any depth already.  Others keep the
+     *  old reserve when it cannot grow, the slab is still there.
+     */
+    if (!algot_zoned(nd))
+        mempool_resize(nd->rq_pool, q->nr_requests);
+}
+
+static int algot_init_hctx(struct blk_mq_hw_ctx *hctx, unsigned int hctx_idx)
+{
+    struct algot_stage *st;
+
+    st = kmalloc_node(sizeof(*st), GFP_KERNEL, hctx->numa_node);
+    if (!st)
+        return -ENOMEM;
+    spin_lock_init(&st->lock);
+    INIT_LIST_HEAD(&st->list);
+    hctx->sched_data = st;
+
+    algot_depth_updated(hctx);
+    return 0;
+}
+
+static void algot_exit_hctx(struct blk_mq_hw_ctx *hctx, unsigned int hctx_idx)
+{
+    struct algot_stage *st = hctx->sched_data;
+
+    BUG_ON(!list_empty(&st->list));
+    kfree(st);
+    hctx->sched_data = NULL;
+}
+
+/*
+ * Runs as the request is allocated, which must not sleep.  When the slab
+ *  has nothing at hand, the pool still has algot_reserve() in reserve; a
+ *  request left without goes straight to dispatch, see algot_insert().
+ */
+static void algot_prepare_request(struct request *rq)
+{
+    struct algot_data *nd = rq->q->elevator->elevator_data;
+    struct algot_rq *m;
+
+    /* Only sync reads get an icq, none is left over from a last owner */
+    rq->elv.icq = NULL;
+    m = mempool_alloc(nd->rq_pool, GFP_NOWAIT | __GFP_NOWARN);
+    rq->elv.priv[0] = m;
+    if (!m)
+        return;
+    m->slot = ALGOT_SLOT_NONE;
+    m->next_slot = ALGOT_SLOT_NONE;
+    m->deadline = 0;
+    m->issued = 0;
+    m->ic = NULL;
+    m->rq = rq;
+    INIT_LIST_HEAD(&m->group);
+    INIT_LIST_HEAD(&m->zone);
+    m->moved = false;
+    /* Only streams need it, and the io_context goes along with the icq */
+    if (rq_data_dir(rq) == READ && rq_is_sync(rq))
+        rq->elv.icq = ioc_find_get_icq(rq->q);
+}
+
+/*
+ * A request issued at issued ns completed at now, or was requeued with
+ *  both 0.  Once per window of completions the device counts as
+ *  reordering when a quarter of them came in ahead of one issued earlier,
+ *  and under a latency target the depth is adjusted: down by a quarter
+ *  when they took longer on average, up by one when they stayed well
+ *  within and dispatch was held back meanwhile.  May run in interrupt
+ *  context, without nd->lock.
+ */
+static void algot_done(struct algot_data *nd, u64 issued, u64 now)
+{
+    u64 target = (u64)READ_ONCE(nd->target_latency) * NSEC_PER_USEC;
+    unsigned long flags;
+    unsigned int depth;
+
+    atomic_dec(&nd->inflight);
+    /* Pairs with the barrier in algot_throttle() */
+    smp_mb__after_atomic();
+    if (READ_ONCE(nd->throttled))
+    {
+        WRITE_ONCE(nd->throttled, false);
+        blk_mq_run_hw_queues(nd->queue, true);
+    }
+    if (!now)
+        return;
+
+    spin_lock_irqsave(&nd->done_lock, flags);
+    depth = nd->depth;
+    nd->lat_sum += now - issued;
+    if (issued < nd->done_issued)
+        nd->reordered++;
+    nd->done_issued = issued;
+    if (++nd->lat_n >= max(depth, ALGOT_DEPTH_WINDOW))
+    {
+        nd->lat_avg = div_u64(nd->lat_sum, nd->lat_n);
+        WRITE_ONCE(nd->reordering, nd->reordered * 4 >= nd->lat_n);
+        nd->lat_sum = 0;
+        nd->lat_n = 0;
+        nd->reordered = 0;
+        if (!depth)
+            ;
+        else if (nd->lat_avg > target)
+            depth = depth > 1 ? depth - max(depth / 4, 1U) : 1;
+        else if (nd->lat_avg < target - target / 4 && nd->limited &&
+                 depth < blk_queue_depth(nd->queue))
+            depth++;
+        nd->limited = false;
+        WRITE_ONCE(nd->depth, depth);
+    }
+    spin_unlock_irqrestore(&nd->done_lock, flags);
+}
+
+/* Feeds the head estimates and the depth, runs in interrupt context */
+static void algot_completed_request(struct request *rq, u64 now)
+{
+    struct algot_data *nd = rq->q->elevator->elevator_data;
+    struct algot_rq *m = algot_rq(rq);
+    struct algot_icq *ic = algot_icq(rq);
+    u64 wait = (u64)READ_ONCE(nd->antic_expire) * NSEC_PER_USEC;
+
+    if (!now)
+        now = ktime_get_ns();
+    if (m && m->next_slot == ALGOT_SLOT_ISSUED)
+    {
+        m->next_slot = ALGOT_SLOT_NONE;
+        algot_done(nd, m->issued, now);
+    }
+    WRITE_ONCE(nd->done_ns, now);
+    WRITE_ONCE(nd->done_pos, blk_rq_pos(rq));
+    if (!ic)
+        return;
+
+    WRITE_ONCE(ic->done_ns, now);
+    if (ic == READ_ONCE(nd->antic) && wait)
+    {
+        WRITE_ONCE(nd->antic_until, now + wait);
+        hrtimer_start(&nd->antic_timer, ns_to_ktime(wait), HRTIMER_MODE_REL);
+    }
+}
+
+/* rq goes back to be inserted again, it is no longer in flight */
+static void algot_requeue_request(struct request *rq)
+{
+    struct algot_data *nd = rq->q->elevator->elevator_data;
+    struct algot_rq *m = algot_rq(rq);
+
+    if (m && m->next_slot == ALGOT_SLOT_ISSUED)
+    {
+        m->next_slot = ALGOT_SLOT_NONE;
+        algot_done(nd, 0, 0);
+    }
+}
+
+/*
+ * rq is freed, ours goes back to the pool and the io_context its icq
+ *  holds is put.  The next write of rq's zone may go, the queue runs
+ *  again for it.  May run in interrupt context.
+ */
+static void algot_finish_request(struct request *rq)
+{
+    struct algot_data *nd = rq->q->elevator->elevator_data;
+    unsigned long flags;
+
+    if (algot_rq(rq))
+    {
+        mempool_free(algot_rq(rq), nd->rq_pool);
+        rq->elv.priv[0] = NULL;
+    }
+    if (rq->elv.icq)
+    {
+        put_io_context(rq->elv.icq->ioc);
+        rq->elv.icq = NULL;
+    }
+    if (!algot_zoned(nd))
+        return;
+
+    spin_lock_irqsave(&nd->zone_lock, flags);
+    blk_req_zone_write_unlock(rq);
+    spin_unlock_irqrestore(&nd->zone_lock, flags);
+    if (algot_queued(nd, WRITE))
+        blk_mq_sched_mark_restart_hctx(rq->mq_hctx);
+}
+
+/* ic goes away, called with the queue_lock held */
+static void algot_exit_icq(struct io_cq *icq)
+{
+    struct algot_data *nd = icq->q->elevator->elevator_data;
+
+    spin_lock(&nd->lock);
+    if (nd->antic == container_of(icq, struct algot_icq, icq))
+        nd->antic = NULL;
+    spin_unlock(&nd->lock);
+}
+
+/* Neighbours by sector in sort_queue or wait_sort, whichever holds rq */
+static struct request *
+algot_former_request(struct request_queue *q, struct request *rq)
+{
+    if (!algot_rq(rq) || algot_rq(rq)->slot == ALGOT_SLOT_NONE)
+        return NULL;
+    return elv_rb_former_request(q, rq);
+}
+
+static struct request *
+algot_latter_request(struct request_queue *q, struct request *rq)
+{
+    if (!algot_rq(rq) || algot_rq(rq)->slot == ALGOT_SLOT_NONE)
+        return NULL;
+    return elv_rb_latter_request(q, rq);
+}
+
+static void *algot_alloc_matrix(unsigned long ms, int node, bool *vloc)
+{
+    size_t size = sizeof(sector_t)*2*mx_half(max(ms, 2UL));
+    void *mx;
+
+    *vloc = false;
+    mx = kmalloc_node(size, GFP_KERNEL | __GFP_NOWARN, node);
+    if (mx == NULL)
+    {
+        mx = vmalloc_node(size, node);
+        *vloc = true;
+    }
+    return mx;
+}
+
+static void algot_free_matrix(void *mx, bool vloc)
+{
+    if (vloc)
+        vfree(mx);
+    else
+        kfree(mx);
+}
+
+static void algot_free_plan(struct algot_plan *p)
+{
+    algot_free_matrix(p->cost_matrix, p->vloc);
+    kfree(p->sorted);
+    kfree(p->prev_idx);
+    kfree(p->chain);
+    kfree(p->pos);
+    kfree(p->adj);
+    kfree(p->xfer);
+    kfree(p->wsum);
+    kfree(p->ang);
+}
+
+static int algot_alloc_plan(struct algot_plan *p, unsigned int ms, int node)
+{
+    p->cost_matrix = algot_alloc_matrix(ms, node, &p->vloc);
+    p->sorted = kmalloc_node(sizeof(void*)*ms, GFP_KERNEL, node);
+    p->prev_idx = kmalloc_node(sizeof(unsigned int)*ms, GFP_KERNEL, node);
+    p->chain = kmalloc_node(sizeof(unsigned int)*ms, GFP_KERNEL, node);
+    p->pos = kmalloc_node(sizeof(sector_t)*ms, GFP_KERNEL, node);
+    p->adj = kmalloc_node(sizeof(sector_t)*ms, GFP_KERNEL, node);
+    p->xfer = kmalloc_node(sizeof(sector_t)*ms, GFP_KERNEL, node);
+    p->wsum = kmalloc_node(sizeof(u32)*(ms+1), GFP_KERNEL, node);
+    p->ang = kmalloc_node(sizeof(u32)*ms, GFP_KERNEL, node);
+    p->ns = 0;
+    p->narrow = false;
+    p->greedy = false;
+    p->model.n = 0;
+    p->rot.nz = 0;
+    p->stripe.chunk = 0;
+    p->stripe.width = 0;
+    p->xfer_cost = 0;
+    p->size_weight = 0;
+    p->rt_weight = 1;
+
+    if (!p->cost_matrix || !p->sorted || !p->prev_idx ||
+        !p->chain || !p->pos || !p->adj || !p->xfer ||
+        !p->wsum || !p->ang)
+    {
+        algot_free_plan(p);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+static void algot_free_window(struct algot_window *w)
+{
+    algot_free_plan(&w->cur);
+    algot_free_plan(&w->next);
+}
+
+static int algot_alloc_window(struct algot_window *w, unsigned int ms, int node)
+{
+    if (algot_alloc_plan(&w->cur, ms, node))
+        return -ENOMEM;
+    if (algot_alloc_plan(&w->next, ms, node))
+    {
+        algot_free_plan(&w->cur);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+/*
+ * Reallocate the window for cap requests, the ones that no longer fit go
+ *  back to wait_queue, highest sectors first.  Called with resize_lock
+ *  held.
+ */
+static int algot_resize(struct algot_data *nd, unsigned int cap)
+{
+    struct request_queue *q = nd->queue;
+    struct algot_window win;
+    struct request *req;
+    int dir;
+
+    if (algot_alloc_window(&win, cap, q->node))
+        return -ENOMEM;
+
+    blk_mq_quiesce_queue(q);
+    flush_work(&nd->rebuild_work);
+    spin_lock(&nd->lock);
+
+    /* Drop the current plan, the next dispatch rebuilds it */
+    algot_drop_plan(nd);
+
+    for (dir = READ; dir <= WRITE; dir++)
+    {
+        while (nd->nsorted[dir] > cap)
+        {
+            req = rb_entry_rq(rb_last(&nd->sort_queue[dir]));
+            elv_rb_del(&nd->sort_queue[dir], req);
+            list_del_init(&req->queuelist);
+            algot_wait(nd, req);
+            nd->nsorted[dir]--;
+            algot_group_window(req, -1);
+        }
+    }
+
+    swap(nd->win, win);
+    nd->win_cap = cap;
+    nd->stats.resizes++;
+
+    spin_unlock(&nd->lock);
+    blk_mq_unquiesce_queue(q);
+
+    algot_free_window(&win);
+    return 0;
+}
+
+/*
+ * Grow the window for what is queued once requests wait for room, or
+ *  shrink it after the queue idled for ALGOT_IDLE_RELEASE.
+ */
+static void algot_resize_work(struct work_struct *work)
+{
+    struct algot_data *nd = container_of(to_delayed_work(work),
+                                         struct algot_data, resize_work);
+    unsigned int cap, need;
+    int dir;
+
+    mutex_lock(&nd->resize_lock);
+    spin_lock(&nd->lock);
+    cap = nd->win_cap;
+    if (algot_queued(nd, READ) || algot_queued(nd, WRITE))
+    {
+        for (dir = READ; dir <= WRITE; dir++)
+        {
+            need = nd->nsorted[dir] + list_count_nodes(&nd->wait_queue[dir]);
+            if (need > cap)
+                cap = min_t(unsigned int, roundup_pow_of_two(need),
+                            nd->calc_max);
+        }
+    }
+    else if (time_after_eq(jiffies, nd->busy + ALGOT_IDLE_RELEASE))
+        cap = min_t(unsigned int, nd->calc_max, ALGOT_CALC_MIN);
+    if (cap == nd->win_cap)
+        cap = 0;
+    spin_unlock(&nd->lock);
+
+    /* On failure the window stays as it is until more requests wait */
+    if (cap)
+        algot_resize(nd, cap);
+    mutex_unlock(&nd->resize_lock);
+}
+
+/*
+ * The layout a striped volume reports: io_min is its chunk, io_opt a full
+ *  row of them.  Anything else is taken as one member.
+ */
+static void algot_stripe_limits(struct algot_data *nd)
+{
+    unsigned int min = queue_io_min(nd->queue), opt = queue_io_opt(nd->queue);
+
+    nd->stripe.chunk = min >> SECTOR_SHIFT;
+    nd->stripe.width = 1;
+    if (nd->stripe.chunk && opt > min && opt % min == 0)
+        nd->stripe.width = opt / min;
+}
+
+static int algot_init_queue(struct request_queue *q, struct elevator_type *e)
+{
+    struct elevator_queue *eq;
+    struct algot_data *nd;
+    unsigned long ms = ALGOT_CALC_MAX;
+    int dir;
+
+    eq = elevator_alloc(q, e);
+    if (!eq)
+        return -ENOMEM;
+
+    nd = kmalloc_node(sizeof(*nd), GFP_KERNEL, q->node);
+    if (!nd)
+        goto put_eq;
+
+    nd->queue = q;
+    spin_lock_init(&nd->lock);
+    nd->calc_max = ms;
+    nd->win_cap = min_t(unsigned int, ms, ALGOT_CALC_MIN);
+    nd->busy = jiffies;
+    nd->fg_busy = jiffies;
+    nd->dirty_count = ALGOT_DIRTY_COUNT;
+    nd->dirty_limit = ALGOT_DIRTY_COUNT;
+    nd->rw_head = 0;
+    nd->rw_end = 0;
+    nd->done_pos = 0;
+    nd->done_ns = 0;
+    nd->dir = READ;
+    nd->batched = 0;
+    nd->starved = 0;
+    nd->dirty = ALGOT_DIRTY_COUNT-1;
+    nd->redo = true;
+    nd->gate_shift = 0;
+    nd->opt_s = 1;
+    nd->opt_e = 0;
+    nd->holes = 0;
+    nd->cell_cost = ALGOT_CELL_COST;
+    nd->antic = NULL;
+    nd->antic_rq = NULL;
+    nd->antic_until = 0;
+    nd->antic_run = 0;
+    hrtimer_init(&nd->antic_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    nd->antic_timer.function = algot_antic_timer;
+    atomic_set(&nd->inflight, 0);
+    nd->depth = ALGOT_TARGET_LATENCY ? blk_queue_depth(q) : 0;
+    nd->throttled = false;
+    nd->limited = false;
+    spin_lock_init(&nd->done_lock);
+    nd->lat_sum = 0;
+    nd->lat_n = 0;
+    nd->lat_avg = 0;
+    nd->done_issued = 0;
+    nd->reordered = 0;
+    nd->reordering = false;
+    nd->rebuilding = false;
+    INIT_WORK(&nd->rebuild_work, algot_rebuild_work);
+    INIT_DELAYED_WORK(&nd->resize_work, algot_resize_work);
+    mutex_init(&nd->resize_lock);
+    nd->async_depth = q->nr_requests;
+    INIT_LIST_HEAD(&nd->dispatch);
+    spin_lock_init(&nd->ready_lock);
+    spin_lock_init(&nd->zone_lock);
+    INIT_LIST_HEAD(&nd->ready);
+    for (dir = READ; dir <= WRITE; dir++)
+    {
+        INIT_LIST_HEAD(&nd->wait_queue[dir]);
+        INIT_LIST_HEAD(&nd->fifo[dir]);
+        nd->sort_queue[dir] = RB_ROOT;
+        nd->wait_sort[dir] = RB_ROOT;
+        nd->nsorted[dir] = 0;
+        nd->nwaiting[dir] = 0;
+        nd->rt_waiting[dir] = 0;
+        nd->idle_waiting[dir] = 0;
+    }
+    for (dir = READ; dir <= WRITE; dir++)
+    {
+        nd->groups[dir] = 0;
+        nd->group_weight[dir] = 0;
+        INIT_LIST_HEAD(&nd->wait_groups[dir]);
+    }
+    memset(&nd->nogroup, 0, sizeof(nd->nogroup));
+    algot_group_init(&nd->nogroup);
+    nd->zone_sort = RB_ROOT;
+    INIT_LIST_HEAD(&nd->zone_fifo);
+    INIT_LIST_HEAD(&nd->zones);
+
+    nd->adapt_dirty = true;
+    nd->plan_gate = true;
+    nd->incremental = true;
+    nd->narrow_matrix = true;
+    nd->async_rebuild = false;
+    nd->front_merges = true;
+    nd->stripe_aware = false;
+    algot_stripe_limits(nd);
+    nd->bucket_sectors = 0;
+    nd->antic_expire = ALGOT_ANTIC_EXPIRE;
+    nd->target_latency = ALGOT_TARGET_LATENCY;
+    nd->greedy_max = ALGOT_GREEDY_MAX;
+    nd->program_budget = ALGOT_PROGRAM_BUDGET;
+    nd->fifo_expire[READ] = ALGOT_READ_EXPIRE;
+    nd->fifo_expire[WRITE] = ALGOT_WRITE_EXPIRE;
+    nd->writes_starved = ALGOT_WRITES_STARVED;
+    nd->fifo_batch = ALGOT_FIFO_BATCH;
+    nd->dispatch_batch = ALGOT_DISPATCH_BATCH;
+    nd->model.n = 0;
+    nd->rot.nz = 0;
+    nd->xfer_cost = 0;
+    nd->size_weight = 0;
+    nd->rt_weight = ALGOT_RT_WEIGHT;
+    nd->idle_delay = ALGOT_IDLE_DELAY;
+    memset(&nd->stats, 0, sizeof(nd->stats));
+
+    if (algot_alloc_window(&nd->win, nd->win_cap, q->node))
+    {
+        printk(KERN_ALERT "failed to allocate memory for algot\n");
+        goto free_nd;
+    }
+
+    nd->rq_pool = mempool_create_node(algot_reserve(nd), mempool_alloc_slab,
+                                      mempool_free_slab, algot_rq_cache,
+                                      GFP_KERNEL, q->node);
+    if (!nd->rq_pool)
+        goto free_win;
+
+#ifdef CONFIG_BLK_CGROUP
+    if (blkcg_activate_policy(q->disk, &algot_blkcg_policy))
+        goto free_pool;
+#endif
+
+    /* There is only one disk head, dispatch queue wide */
+    blk_queue_flag_set(QUEUE_FLAG_SQ_SCHED, q);
+
+    eq->elevator_data = nd;
+    q->elevator = eq;
+    return 0;
+
+#ifdef CONFIG_BLK_CGROUP
+free_pool:
+    mempool_destroy(nd->rq_pool);
+#endif
+free_win:
+    algot_free_window(&nd->win);
+free_nd:
+    kfree(nd);
+put_eq:
+    kobject_put(&eq->kobj);
+    return -ENOMEM;
+}
+
+static void algot_exit_queue(struct elevator_queue *e)
+{
+    struct algot_data *nd = e->elevator_data;
+    int dir;
+
+    hrtimer_cancel(&nd->antic_timer);
+    cancel_delayed_work_sync(&nd->resize_work);
+    cancel_work_sync(&nd->rebuild_work);
+    for (dir = READ; dir <= WRITE; dir++)
+    {
+        BUG_ON(!RB_EMPTY_ROOT(&nd->sort_queue[dir]));
+        BUG_ON(!list_empty(&nd->wait_queue[dir]));
+        BUG_ON(!list_empty(&nd->fifo[dir]));
+    }
+    BUG_ON(!list_empty(&nd->zone_fifo));
+    BUG_ON(!list_empty(&nd->dispatch));
+    BUG_ON(!list_empty(&nd->ready));
+#ifdef CONFIG_BLK_CGROUP
+    blkcg_deactivate_policy(nd->queue->disk, &algot_blkcg_policy);
+#endif
+    algot_free_window(&nd->win);
+    mempool_destroy(nd->rq_pool);
+    kfree(nd);
+}
+
+/*
+ * sysfs parts below
+ */
+static ssize_t algot_calc_max_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return sprintf(page, "%u\n", nd->calc_max);
+}
+
+static ssize_t algot_calc_max_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    unsigned int val;
+    int ret;
+
+    ret = kstrtouint(page, 10, &val);
+    if (ret)
+        return ret;
+    if (val < 1 || val > ALGOT_CALC_LIMIT)
+        return -EINVAL;
+
+    /* A smaller window is installed right away, growing is left to demand */
+    mutex_lock(&nd->resize_lock);
+    if (val < nd->win_cap)
+        ret = algot_resize(nd, val);
+    if (!ret)
+    {
+        spin_lock(&nd->lock);
+        nd->calc_max = val;
+        spin_unlock(&nd->lock);
+        kblockd_mod_delayed_work_on(WORK_CPU_UNBOUND, &nd->resize_work, 0);
+    }
+    mutex_unlock(&nd->resize_lock);
+    return ret ? ret : count;
+}
+
+static ssize_t algot_dirty_count_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return sprintf(page, "%d\n", nd->dirty_count);
+}
+
+static ssize_t algot_dirty_count_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    int val, ret;
+
+    ret = kstrtoint(page, 10, &val);
+    if (ret)
+        return ret;
+    if (val < 1 || val > ALGOT_CALC_LIMIT)
+        return -EINVAL;
+
+    spin_lock(&nd->lock);
+    nd->dirty_count = val;
+    if (nd->dirty >= nd->dirty_limit)
+        nd->dirty = val;
+    nd->dirty_limit = val;
+    spin_unlock(&nd->lock);
+    return count;
+}
+
+static ssize_t algot_adapt_dirty_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return sprintf(page, "%d\n", nd->adapt_dirty);
+}
+
+static ssize_t algot_adapt_dirty_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    bool val;
+    int ret;
+
+    ret = kstrtobool(page, &val);
+    if (ret)
+        return ret;
+
+    spin_lock(&nd->lock);
+    nd->adapt_dirty = val;
+    if (nd->dirty >= nd->dirty_limit)
+        nd->dirty = nd->dirty_count;
+    nd->dirty_limit = nd->dirty_count;
+    spin_unlock(&nd->lock);
+    return count;
+}
+
+static ssize_t algot_plan_gate_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return sprintf(page, "%d\n", nd->plan_gate);
+}
+
+static ssize_t algot_plan_gate_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    bool val;
+    int ret;
+
+    ret = kstrtobool(page, &val);
+    if (ret)
+        return ret;
+
+    spin_lock(&nd->lock);
+    nd->plan_gate = val;
+    nd->redo = true;
+    spin_unlock(&nd->lock);
+    return count;
+}
+
+static ssize_t algot_incremental_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return sprintf(page, "%d\n", nd->incremental);
+}
+
+static ssize_t algot_incremental_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    bool val;
+    int ret;
+
+    ret = kstrtobool(page, &val);
+    if (ret)
+        return ret;
+
+    spin_lock(&nd->lock);
+    nd->incremental = val;
+    spin_unlock(&nd->lock);
+    return count;
+}
+
+static ssize_t algot_narrow_matrix_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return sprintf(page, "%d\n", nd->narrow_matrix);
+}
+
+static ssize_t algot_narrow_matrix_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    bool val;
+    int ret;
+
+    ret = kstrtobool(page, &val);
+    if (ret)
+        return ret;
+
+    spin_lock(&nd->lock);
+    nd->narrow_matrix = val;
+    spin_unlock(&nd->lock);
+    return count;
+}
+
+static ssize_t algot_async_rebuild_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return sprintf(page, "%d\n", nd->async_rebuild);
+}
+
+static ssize_t algot_async_rebuild_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    bool val;
+    int ret;
+
+    ret = kstrtobool(page, &val);
+    if (ret)
+        return ret;
+
+    spin_lock(&nd->lock);
+    nd->async_rebuild = val;
+    spin_unlock(&nd->lock);
+    return count;
+}
+
+static ssize_t algot_front_merges_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return sprintf(page, "%d\n", nd->front_merges);
+}
+
+static ssize_t algot_front_merges_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    bool val;
+    int ret;
+
+    ret = kstrtobool(page, &val);
+    if (ret)
+        return ret;
+
+    spin_lock(&nd->lock);
+    nd->front_merges = val;
+    spin_unlock(&nd->lock);
+    return count;
+}
+
+static ssize_t algot_stripe_aware_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return sprintf(page, "%d\n", nd->stripe_aware);
+}
+
+/* Applies from the next calculation, which is forced */
+static ssize_t algot_stripe_aware_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    bool val;
+    int ret;
+
+    ret = kstrtobool(page, &val);
+    if (ret)
+        return ret;
+
+    spin_lock(&nd->lock);
+    nd->stripe_aware = val;
+    algot_redo(nd);
+    spin_unlock(&nd->lock);
+    return count;
+}
+
+static ssize_t algot_stripe_sectors_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return sprintf(page, "%u\n", nd->stripe.chunk);
+}
+
+/* Applies from the next calculation, which is forced */
+static ssize_t algot_stripe_sectors_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    unsigned int val;
+    int ret;
+
+    ret = kstrtouint(page, 10, &val);
+    if (ret)
+        return ret;
+
+    spin_lock(&nd->lock);
+    nd->stripe.chunk = val;
+    algot_redo(nd);
+    spin_unlock(&nd->lock);
+    return count;
+}
+
+static ssize_t algot_stripe_members_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return sprintf(page, "%u\n", nd->stripe.width);
+}
+
+/* Applies from the next calculation, which is forced */
+static ssize_t algot_stripe_members_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    unsigned int val;
+    int ret;
+
+    ret = kstrtouint(page, 10, &val);
+    if (ret)
+        return ret;
+    if (val < 1)
+        return -EINVAL;
+
+    spin_lock(&nd->lock);
+    nd->stripe.width = val;
+    algot_redo(nd);
+    spin_unlock(&nd->lock);
+    return count;
+}
+
+static ssize_t algot_bucket_sectors_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return sprintf(page, "%u\n", nd->bucket_sectors);
+}
+
+static ssize_t algot_bucket_sectors_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    unsigned int val;
+    int ret;
+
+    ret = kstrtouint(page, 10, &val);
+    if (ret)
+        return ret;
+
+    spin_lock(&nd->lock);
+    nd->bucket_sectors = val;
+    spin_unlock(&nd->lock);
+    return count;
+}
+
+static ssize_t algot_antic_expire_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return sprintf(page, "%u\n", nd->antic_expire);
+}
+
+/* 0 stops waiting for a stream right away */
+static ssize_t algot_antic_expire_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    unsigned int val;
+    int ret;
+
+    ret = kstrtouint(page, 10, &val);
+    if (ret)
+        return ret;
+
+    spin_lock(&nd->lock);
+    WRITE_ONCE(nd->antic_expire, val);
+    if (!val)
+        nd->antic = NULL;
+    spin_unlock(&nd->lock);
+    blk_mq_run_hw_queues(nd->queue, true);
+    return count;
+}
+
+static ssize_t algot_target_latency_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return sprintf(page, "%u\n", nd->target_latency);
+}
+
+/* The depth starts over from the queue depth, 0 lifts it */
+static ssize_t algot_target_latency_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    unsigned int val;
+    int ret;
+
+    ret = kstrtouint(page, 10, &val);
+    if (ret)
+        return ret;
+
+    spin_lock_irq(&nd->done_lock);
+    WRITE_ONCE(nd->target_latency, val);
+    WRITE_ONCE(nd->depth, val ? blk_queue_depth(nd->queue) : 0);
+    nd->limited = false;
+    nd->lat_sum = 0;
+    nd->lat_n = 0;
+    nd->reordered = 0;
+    spin_unlock_irq(&nd->done_lock);
+    blk_mq_run_hw_queues(nd->queue, true);
+    return count;
+}
+
+static ssize_t algot_greedy_max_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return sprintf(page, "%u\n", nd->greedy_max);
+}
+
+/* Applies from the next calculation, which is forced */
+static ssize_t algot_greedy_max_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    unsigned int val;
+    int ret;
+
+    ret = kstrtouint(page, 10, &val);
+    if (ret)
+        return ret;
+
+    spin_lock(&nd->lock);
+    nd->greedy_max = val;
+    algot_redo(nd);
+    spin_unlock(&nd->lock);
+    return count;
+}
+
+static ssize_t algot_program_budget_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return sprintf(page, "%u\n", nd->program_budget);
+}
+
+/* Applies from the next calculation */
+static ssize_t algot_program_budget_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    unsigned int val;
+    int ret;
+
+    ret = kstrtouint(page, 10, &val);
+    if (ret)
+        return ret;
+
+    spin_lock(&nd->lock);
+    nd->program_budget = val;
+    spin_unlock(&nd->lock);
+    return count;
+}
+
+static ssize_t algot_expire_show(unsigned long expire, char *page)
+{
+    return sprintf(page, "%u\n", jiffies_to_msecs(expire));
+}
+
+static ssize_t algot_expire_store(struct algot_data *nd, unsigned long *expire,
+                 const char *page, size_t count)
+{
+    unsigned int val;
+    int ret;
+
+    ret = kstrtouint(page, 10, &val);
+    if (ret)
+        return ret;
+    if (val < 1)
+        return -EINVAL;
+
+    spin_lock(&nd->lock);
+    *expire = msecs_to_jiffies(val);
+    spin_unlock(&nd->lock);
+    return count;
+}
+
+/* Deadlines in ms, new values only apply to requests queued afterwards */
+static ssize_t algot_read_expire_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return algot_expire_show(nd->fifo_expire[READ], page);
+}
+
+static ssize_t algot_read_expire_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return algot_expire_store(nd, &nd->fifo_expire[READ], page, count);
+}
+
+static ssize_t algot_write_expire_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return algot_expire_show(nd->fifo_expire[WRITE], page);
+}
+
+static ssize_t algot_write_expire_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return algot_expire_store(nd, &nd->fifo_expire[WRITE], page, count);
+}
+
+static ssize_t algot_writes_starved_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return sprintf(page, "%u\n", nd->writes_starved);
+}
+
+static ssize_t algot_writes_starved_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    unsigned int val;
+    int ret;
+
+    ret = kstrtouint(page, 10, &val);
+    if (ret)
+        return ret;
+
+    spin_lock(&nd->lock);
+    nd->writes_starved = val;
+    spin_unlock(&nd->lock);
+    return count;
+}
+
+static ssize_t algot_fifo_batch_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return sprintf(page, "%u\n", nd->fifo_batch);
+}
+
+static ssize_t algot_fifo_batch_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    unsigned int val;
+    int ret;
+
+    ret = kstrtouint(page, 10, &val);
+    if (ret)
+        return ret;
+    if (val < 1)
+        return -EINVAL;
+
+    spin_lock(&nd->lock);
+    nd->fifo_batch = val;
+    spin_unlock(&nd->lock);
+    return count;
+}
+
+static ssize_t algot_dispatch_batch_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return sprintf(page, "%u\n", nd->dispatch_batch);
+}
+
+static ssize_t algot_dispatch_batch_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    unsigned int val;
+    int ret;
+
+    ret = kstrtouint(page, 10, &val);
+    if (ret)
+        return ret;
+    if (val < 1)
+        return -EINVAL;
+
+    spin_lock(&nd->lock);
+    nd->dispatch_batch = val;
+    spin_unlock(&nd->lock);
+    return count;
+}
+
+static ssize_t algot_seek_model_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+    ssize_t len = 0;
+    unsigned int i;
+
+    spin_lock(&nd->lock);
+    for (i = 0; i < nd->model.n; i++)
+        len += sprintf(page+len, "%s%llu:%llu", i ? " " : "",
+                       (unsigned long long)nd->model.dist[i],
+                       (unsigned long long)nd->model.cost[i]);
+    spin_unlock(&nd->lock);
+    len += sprintf(page+len, "\n");
+    return len;
+}
+
+/*
+ * "distance:cost" points separated by spaces, nothing to go back to the
+ *  raw distance.  A model whose last segment cannot reach across the disk
+ *  within 64 bits is refused.  Applies from the next calculation, which
+ *  is forced.
+ */
+static ssize_t algot_seek_model_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    struct algot_model m;
+    unsigned long long dist, cost;
+    unsigned int n = 0;
+    int len;
+
+    while (sscanf(page, " %llu:%llu%n", &dist, &cost, &len) == 2)
+    {
+        if (n == ALGOT_MODEL_POINTS)
+            return -EINVAL;
+        m.dist[n] = dist;
+        m.cost[n++] = cost;
+        page += len;
+    }
+    if (*skip_spaces(page) || !algot_model_set(&m, n) ||
+        (m.n && m.far < get_capacity(nd->queue->disk)))
+        return -EINVAL;
+
+    spin_lock(&nd->lock);
+    nd->model = m;
+    algot_redo(nd);
+    spin_unlock(&nd->lock);
+    return count;
+}
+
+static ssize_t algot_rotation_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+    ssize_t len = 0;
+    unsigned int z;
+
+    spin_lock(&nd->lock);
+    if (nd->rot.nz)
+        len += sprintf(page, "%lu",
+                       (unsigned long)DIV_ROUND_CLOSEST(60 * USEC_PER_SEC, nd->rot.rev));
+    for (z = 0; z < nd->rot.nz; z++)
+        len += sprintf(page+len, " %llu:%u",
+                       (unsigned long long)nd->rot.start[z], nd->rot.spt[z]);
+    spin_unlock(&nd->lock);
+    len += sprintf(page+len, "\n");
+    return len;
+}
+
+/*
+ * "rpm start:sectors_per_track ..." with the zones in ascending order from
+ *  sector 0, nothing to stop costing rotation.  Applies from the next
+ *  calculation, which is forced.
+ */
+static ssize_t algot_rotation_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    struct algot_rotation r;
+    unsigned long long start;
+    unsigned int rpm, spt, nz = 0;
+    int len;
+
+    r.rev = 0;
+    if (sscanf(page, " %u%n", &rpm, &len) == 1)
+    {
+        if (!rpm)
+            return -EINVAL;
+        r.rev = DIV_ROUND_CLOSEST(60 * USEC_PER_SEC, rpm);
+        page += len;
+        while (sscanf(page, " %llu:%u%n", &start, &spt, &len) == 2)
+        {
+            if (nz == ALGOT_ZONES)
+                return -EINVAL;
+            r.start[nz] = start;
+            r.spt[nz++] = spt;
+            page += len;
+        }
+        if (!nz)
+            return -EINVAL;
+    }
+    if (*skip_spaces(page) || !algot_rotation_set(&r, nz))
+        return -EINVAL;
+
+    spin_lock(&nd->lock);
+    nd->rot = r;
+    algot_redo(nd);
+    spin_unlock(&nd->lock);
+    return count;
+}
+
+static ssize_t algot_transfer_cost_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return sprintf(page, "%u\n", nd->xfer_cost);
+}
+
+/* Applies from the next calculation, which is forced */
+static ssize_t algot_transfer_cost_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    unsigned int val;
+    int ret;
+
+    ret = kstrtouint(page, 10, &val);
+    if (ret)
+        return ret;
+    if (val > ALGOT_XFER_COST_MAX)
+        return -EINVAL;
+
+    spin_lock(&nd->lock);
+    nd->xfer_cost = val;
+    algot_redo(nd);
+    spin_unlock(&nd->lock);
+    return count;
+}
+
+static ssize_t algot_size_weight_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return sprintf(page, "%u\n", nd->size_weight);
+}
+
+/* Applies from the next calculation, which is forced */
+static ssize_t algot_size_weight_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    unsigned int val;
+    int ret;
+
+    ret = kstrtouint(page, 10, &val);
+    if (ret)
+        return ret;
+    if (val && val < ALGOT_SIZE_WEIGHT_MIN)
+        return -EINVAL;
+
+    spin_lock(&nd->lock);
+    nd->size_weight = val;
+    algot_redo(nd);
+    spin_unlock(&nd->lock);
+    return count;
+}
+
+static ssize_t algot_rt_weight_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return sprintf(page, "%u\n", nd->rt_weight);
+}
+
+static ssize_t algot_rt_weight_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    unsigned int val;
+    int ret;
+
+    ret = kstrtouint(page, 10, &val);
+    if (ret)
+        return ret;
+    if (val < 1 || val > ALGOT_RT_WEIGHT_MAX)
+        return -EINVAL;
+
+    spin_lock(&nd->lock);
+    nd->rt_weight = val;
+    algot_redo(nd);
+    spin_unlock(&nd->lock);
+    return count;
+}
+
+static ssize_t algot_idle_delay_show(struct elevator_queue *e, char *page)
+{
+    struct algot_data *nd = e->elevator_data;
+
+    return algot_expire_show(nd->idle_delay, page);
+}
+
+/* In ms, 0 lets idle class requests in as soon as nothing else waits */
+static ssize_t algot_idle_delay_store(struct elevator_queue *e,
+                 const char *page, size_t count)
+{
+    struct algot_data *nd = e->elevator_data;
+    unsigned int val;
+    int ret;
+
+    ret = kstrtouint(page, 10, &val);
+    if (ret)
+        return ret;
+
+    spin_lock(&nd->lock);
+    nd->idle_delay = msecs_to_jiffies(val);
+    spin_unlock(&nd->lock);
+    blk_mq_run_hw_queues(nd->queue, true);
+    return count;
+}
+
+#define ALGOT_ATTR(name) \
+    __ATTR(name, 0644, algot_##name##_show, algot_##name##_store)
+
+static struct elv_fs_entry algot_attrs[] = {
+    ALGOT_ATTR(calc_max),
+    ALGOT_ATTR(dirty_count),
+    ALGOT_ATTR(adapt_dirty),
+    ALGOT_ATTR(plan_gate),
+    ALGOT_ATTR(incremental),
+    ALGOT_ATTR(narrow_matrix),
+    ALGOT_ATTR(async_rebuild),
+    ALGOT_ATTR(front_merges),
+    ALGOT_ATTR(stripe_aware),
+    ALGOT_ATTR(stripe_sectors),
+    ALGOT_ATTR(stripe_members),
+    ALGOT_ATTR(bucket_sectors),
+    ALGOT_ATTR(antic_expire),
+    ALGOT_ATTR(target_latency),
+    ALGOT_ATTR(greedy_max),
+    ALGOT_ATTR(program_budget),
+    ALGOT_ATTR(read_expire),
+    ALGOT_ATTR(write_expire),
+    ALGOT_ATTR(writes_starved),
+    ALGOT_ATTR(fifo_batch),
+    ALGOT_ATTR(dispatch_batch),
+    ALGOT_ATTR(seek_model),
+    ALGOT_ATTR(rotation),
+    ALGOT_ATTR(transfer_cost),
+    ALGOT_ATTR(size_weight),
+    ALGOT_ATTR(rt_weight),
+    ALGOT_ATTR(idle_delay),
+    __ATTR_NULL
+};
+
+#ifdef CONFIG_BLK_DEBUG_FS
+static int algot_stats_show(void *data, struct seq_file *m)
+{
+    struct request_queue *q = data;
+    struct algot_data *nd = q->elevator->elevator_data;
+    struct algot_stats st;
+    unsigned int waiting[2], sorted[2], zoned, cap;
+    u64 lat;
+    u32 cell;
+    int dir, limit;
+
+    spin_lock(&nd->lock);
+    st = nd->stats;
+    cap = nd->win_cap;
+    cell = nd->cell_cost;
+    limit = nd->dirty_limit;
+    for (dir = READ; dir <= WRITE; dir++)
+    {
+        waiting[dir] = list_count_nodes(&nd->wait_queue[dir]);
+        sorted[dir] = nd->nsorted[dir];
+    }
+    zoned = list_count_nodes(&nd->zone_fifo);
+    spin_unlock(&nd->lock);
+    lat = READ_ONCE(nd->lat_avg);
+
+    seq_printf(m, "programs %llu\n", st.programs);
+    seq_printf(m, "program_ns %llu\n", st.program_ns);
+    seq_printf(m, "program_avg_reqs %llu\n",
+               st.programs ? div64_u64(st.program_reqs, st.programs) : 0);
+    seq_printf(m, "greedy %llu\n", st.greedy);
+    seq_printf(m, "bounded %llu\n", st.bounded);
+    seq_printf(m, "cell_ps %llu\n", div_u64((u64)cell * 1000, 256));
+    seq_printf(m, "dispatched %llu\n", st.dispatched);
+    seq_printf(m, "merged %llu\n", st.merged);
+    seq_printf(m, "compactions %llu\n", st.compactions);
+    seq_printf(m, "futile %llu\n", st.futile);
+    seq_printf(m, "gated %llu\n", st.gated);
+    seq_printf(m, "dirty_limit %d\n", limit);
+    seq_printf(m, "resizes %llu\n", st.resizes);
+    seq_printf(m, "window %u\n", cap);
+    seq_printf(m, "staged %llu\n", st.staged);
+    seq_printf(m, "unkept %llu\n", st.unkept);
+    seq_printf(m, "readied %llu\n", st.readied);
+    seq_printf(m, "front_merges %llu\n", st.front_merges);
+    seq_printf(m, "back_merges %llu\n", st.back_merges);
+    seq_printf(m, "discard_merges %llu\n", st.discard_merges);
+    seq_printf(m, "expired %llu\n", st.expired);
+    seq_printf(m, "antic %llu\n", st.antic);
+    seq_printf(m, "antic_hits %llu\n", st.antic_hits);
+    seq_printf(m, "antic_misses %llu\n", st.antic_misses);
+    seq_printf(m, "inflight %d\n", atomic_read(&nd->inflight));
+    seq_printf(m, "depth %u\n", READ_ONCE(nd->depth));
+    seq_printf(m, "latency_us %llu\n", div_u64(lat, NSEC_PER_USEC));
+    seq_printf(m, "reordering %d\n", READ_ONCE(nd->reordering));
+    seq_printf(m, "throttled %llu\n", st.throttled);
+    seq_printf(m, "picks_left %llu\n", st.picks_left);
+    seq_printf(m, "picks_right %llu\n", st.picks_right);
+    seq_printf(m, "picks_inner %llu\n", st.picks_inner);
+    seq_printf(m, "head_travel %llu\n", st.head_travel);
+    seq_printf(m, "sorted %u %u\n", sorted[READ], sorted[WRITE]);
+    seq_printf(m, "waiting %u %u\n", waiting[READ], waiting[WRITE]);
+    seq_printf(m, "zoned %u\n", zoned);
+    return 0;
+}
+
+static const struct blk_mq_debugfs_attr algot_queue_debugfs_attrs[] = {
+    {"stats", 0400, algot_stats_show},
+    {},
+};
+#endif
+
+static struct elevator_type elevator_algot = {
+    .ops = {
+        .depth_updated        = algot_depth_updated,
+        .limit_depth        = algot_limit_depth,
+        .insert_requests        = algot_insert_requests,
+        .dispatch_request        = algot_dispatch_request,
+        .prepare_request        = algot_prepare_request,
+        .completed_request        = algot_completed_request,
+        .requeue_request        = algot_requeue_request,
+        .finish_request        = algot_finish_request,
+        .allow_merge        = algot_allow_merge,
+        .bio_merge        = algot_bio_merge,
+        .request_merge        = algot_request_merge,
+        .request_merged        = algot_request_merged,
+        .requests_merged        = algot_merged_requests,
+        .has_work        = algot_has_work,
+        .former_request        = algot_former_request,
+        .next_request        = algot_latter_request,
+        .exit_icq        = algot_exit_icq,
+        .init_hctx        = algot_init_hctx,
+        .exit_hctx        = algot_exit_hctx,
+        .init_sched        = algot_init_queue,
+        .exit_sched        = algot_exit_queue,
+    },
+#ifdef CONFIG_BLK_DEBUG_FS
+    .queue_debugfs_attrs = algot_queue_debugfs_attrs,
+#endif
+    .icq_size = sizeof(struct algot_icq),
+    .icq_align = __alignof__(struct algot_icq),
+    .elevator_attrs = algot_attrs,
+    .elevator_features = ELEVATOR_F_ZBD_SEQ_WRITE,
+    .elevator_name = "algot",
+    .elevator_owner = THIS_MODULE,
+};
+
+#ifdef CONFIG_BLK_CGROUP
+/*
+ * cgroup parts below
+ */
+static struct algot_cgroup *algot_cgroup(struct cgroup_subsys_state *css)
+{
+    struct blkcg_policy_data *cpd;
+
+    cpd = blkcg_to_cpd(css_to_blkcg(css), &algot_blkcg_policy);
+    return container_of(cpd, struct algot_cgroup, cpd);
+}
+
+static u64 algot_weight_read(struct cgroup_subsys_state *css,
+                 struct cftype *cft)
+{
+    return READ_ONCE(algot_cgroup(css)->weight);
+}
+
+/* Groups with requests queued keep the weight they came in with */
+static int algot_weight_write(struct cgroup_subsys_state *css,
+                 struct cftype *cft, u64 val)
+{
+    if (val < ALGOT_WEIGHT_MIN || val > ALGOT_WEIGHT_MAX)
+        return -ERANGE;
+
+    WRITE_ONCE(algot_cgroup(css)->weight, val);
+    return 0;
+}
+
+/*
+ * One array per hierarchy: cgroup_add_cftypes() links them into a list,
+ *  so the same one cannot be handed to both.
+ */
+static struct cftype algot_blkg_files[] = {
+    {
+        .name = "algot.weight",
+        .flags = CFTYPE_NOT_ON_ROOT,
+        .read_u64 = algot_weight_read,
+        .write_u64 = algot_weight_write,
+    },
+    {}
+};
+
+static struct cftype algot_blkcg_legacy_files[] = {
+    {
+        .name = "algot.weight",
+        .flags = CFTYPE_NOT_ON_ROOT,
+        .read_u64 = algot_weight_read,
+        .write_u64 = algot_weight_write,
+    },
+    {}
+};
+
+static struct blkcg_policy_data *algot_cpd_alloc(gfp_t gfp)
+{
+    struct algot_cgroup *cg;
+
+    cg = kzalloc(sizeof(*cg), gfp);
+    if (!cg)
+        return NULL;
+    cg->weight = ALGOT_WEIGHT;
+    return &cg->cpd;
+}
+
+static void algot_cpd_free(struct blkcg_policy_data *cpd)
+{
+    kfree(container_of(cpd, struct algot_cgroup, cpd));
+}
+
+static struct blkg_policy_data *algot_pd_alloc(struct gendisk *disk,
+                 struct blkcg *blkcg, gfp_t gfp)
+{
+    struct algot_group *g;
+
+    g = kzalloc_node(sizeof(*g), gfp, disk->node_id);
+    if (!g)
+        return NULL;
+    algot_group_init(g);
+    return &g->pd;
+}
+
+/* Every request of the group holds a reference on it through its bio */
+static void algot_pd_free(struct blkg_policy_data *pd)
+{
+    kfree(container_of(pd, struct algot_group, pd));
+}
+
+static struct blkcg_policy algot_blkcg_policy = {
+    .dfl_cftypes = algot_blkg_files,
+    .legacy_cftypes = algot_blkcg_legacy_files,
+    .cpd_alloc_fn = algot_cpd_alloc,
+    .cpd_free_fn = algot_cpd_free,
+    .pd_alloc_fn = algot_pd_alloc,
+    .pd_free_fn = algot_pd_free,
+};
+#endif
+
+static int __init algot_init(void)
+{
+    int ret;
+
+#ifdef CONFIG_X86_64
+    algot_has_avx2 = boot_cpu_has(X86_FEATURE_AVX2) &&
+                     boot_cpu_has(X86_FEATURE_AVX);
+#endif
+
+    algot_rq_cache = KMEM_CACHE(algot_rq, 0);
+    if (!algot_rq_cache)
+        return -ENOMEM;
+
+#ifdef CONFIG_BLK_CGROUP
+    ret = blkcg_policy_register(&algot_blkcg_policy);
+    if (ret)
+        goto destroy_cache;
+#endif
+    ret = elv_register(&elevator_algot);
+    if (!ret)
+        return 0;
+#ifdef CONFIG_BLK_CGROUP
+    blkcg_policy_unregister(&algot_blkcg_policy);
+destroy_cache:
+#endif
+    kmem_cache_destroy(algot_rq_cache);
+    return ret;
 }
 
 static void __exit algot_exit(void)
 {
     elv_unregister(&elevator_algot);
+#ifdef CONFIG_BLK_CGROUP
+    blkcg_policy_unregister(&algot_blkcg_policy);
+#endif
+    kmem_cache_destroy(algot_rq_cache);
 }
 
 module_init(algot_init);
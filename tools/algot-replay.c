@@ -0,0 +1,1306 @@
+/*
+ * algot-replay: replay a block trace through the ALGOT core in userspace
+ *
+ * Reads blkparse text output (or generates a synthetic workload), feeds
+ *  the requests to a scheduler at their trace timestamps and serves them
+ *  one at a time on a modelled rotating disk.  The 'algot' scheduler runs
+ *  the same algot-core.h the kernel builds, with the same window, dirty
+ *  threshold and incremental reuse policy as algot_dispatch_request();
+ *  deadlines, read/write batching and merging are left out so the runs
+ *  compare the ordering alone.  'cscan' and 'fifo' are there to compare
+ *  against.  Readers added with -q read on sequentially, one read at a
+ *  time, for antic_expire to wait for.
+ *
+ *   blkparse -i sda | ./algot-replay -s algot -m sqrt
+ *   ./algot-replay -g 100000 -s cscan
+ *   ./algot-replay -g 100000 -R 1000 -K
+ *   ./algot-replay -g 5000 -i 25 -K -q 1:50 -E 300
+ *
+ * Reported are the total seek distance, the wait from queueing to
+ *  dispatch, the response time, and the CPU time the scheduler took per
+ *  dispatch.
+ */
+#include "kernel-compat.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+struct request {
+    sector_t sector;
+    unsigned int nr_sectors;
+    bool write;
+    double queued;          // arrival, in s
+    double started;         // dispatch, in s
+    double done;            // completion, in s
+    unsigned int idx;       // index in the plan in use, or ALGOT_IDX_NEW
+    int stream;             // reader of -q it came from, -1 for the trace
+};
+
+static inline sector_t blk_rq_pos(const struct request *rq)
+{
+    return rq->sector;
+}
+
+static inline unsigned int blk_rq_sectors(const struct request *rq)
+{
+    return rq->nr_sectors;
+}
+
+/* blkparse output carries no priority, everything counts as best effort */
+static inline unsigned short req_get_ioprio(struct request *rq)
+{
+    (void)rq;
+    return 0;
+}
+
+
+#include "../algot-core.h"
+
+#define REPLAY_CALC_MAX     128
+#define REPLAY_DIRTY_COUNT  8
+#define REPLAY_GREEDY_MAX   2
+#define REPLAY_BUDGET       500
+#define REPLAY_CALC_MIN     16
+#define REPLAY_HOLE_SHARE   4
+#define REPLAY_ANTIC_RUN    16
+#define REPLAY_STREAM_SECTORS  256
+
+enum sched { SCHED_ALGOT, SCHED_CSCAN, SCHED_FIFO };
+enum model { MODEL_SQRT, MODEL_LINEAR, MODEL_NONE };
+
+/*
+ * A process reading on sequentially, one read at a time, that issues its
+ *  next read think after the last one completed.  Its one request is
+ *  reused from read to read.
+ */
+struct replay_stream {
+    struct request rq;
+    struct algot_stream st;     // what algot learns of it
+    double due;                 // when its next read arrives, once pending
+    double done;                // when its last read completed, 0 before
+    bool pending;               // thinking, rq is not queued
+    unsigned long reads;
+};
+
+struct replay {
+    enum sched sched;
+    enum model model;
+    unsigned int calc_max;
+    int dirty_count;
+    bool adapt_dirty;           // move dirty_limit as adapt_dirty does
+    bool plan_gate;             // keep plans as plan_gate does
+    bool incremental;
+    bool narrow_matrix;
+    sector_t capacity;          // for the seek model, in sectors
+    double track_ms;            // shortest seek
+    double full_ms;             // full stroke seek
+    double rpm;
+    double rate;                // transfer, in sectors per s
+    unsigned int spt;           // sectors per track, 0 averages rotation
+    struct algot_stripe volume; // how the disks are striped, width 0 for one
+    struct algot_model costs;   // what algot believes seeks cost
+    struct algot_rotation rot;  // and where it believes sectors are
+    bool stripe_aware;          // order plans by depth on the members of -S
+    unsigned int xfer_cost;     // and what it believes 1 MiB takes
+    unsigned int size_weight;   // sectors per extra unit of weight
+    unsigned int greedy_max;    // widest plan without a matrix
+    unsigned int budget;        // time a calculation should take, in us
+    u32 cell_cost;              // of a cell as measured, in 1/256 ns
+
+    struct request *reqs;       // all requests, in arrival order
+    unsigned long n;
+    unsigned long waiting;      // reqs[waiting..arrived) are in wait_queue
+    unsigned long arrived;
+    struct replay_stream *streams;  // readers of -q
+    unsigned int nstreams;
+    double think;               // of each reader, in s
+    struct request **reads;     // their reads in wait_queue, by arrival
+    unsigned int nreads;
+    sector_t bucket_sectors;    // fill the window by bucket, 0 by age
+    struct request **waitq;     // by bucket, wait_queue by sector
+    unsigned long nwaiting;
+
+    struct request **sortq;     // queued requests by sector
+    unsigned long nsorted;
+    unsigned long sortq_size;
+
+    struct algot_plan cur, next;
+    unsigned int opt_s, opt_e;
+    int dirty;
+    int dirty_limit;
+    bool redo;                  // as in algot_data
+    sector_t gate_shift;
+    sector_t rw_head;           // what the scheduler believes
+    sector_t rw_end;
+    double now;                 // time of the dispatch
+    unsigned int antic_expire;  // as antic_expire, in us
+    struct replay_stream *antic;    // stream dispatch waits for
+    struct request *antic_rq;   // its next read, once it came
+    double antic_until;         // until when
+    unsigned int antic_run;     // reads waited for in a row
+    unsigned long antic_waits;
+    unsigned long antic_hits;
+    unsigned long antic_misses;
+    unsigned long programs;
+    unsigned long bounded;      // plans cut down to the budget
+    unsigned long futile;       // plans that saved less than they took
+    unsigned long gated;        // dirty plans kept by the gate
+};
+
+static void *xmalloc(size_t size)
+{
+    void *p = malloc(size);
+
+    if (!p)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    return p;
+}
+
+/*
+ * Seek time in s for a distance in sectors, between the track to track
+ *  and the full stroke time.  'sqrt' follows the arm accelerating over
+ *  short seeks, which dominates real drives, 'linear' is the textbook
+ *  model.  Both add half a revolution of rotational latency to any seek,
+ *  unless the disk has tracks and replay_run() waits for the sector.
+ */
+static double seek_time(const struct replay *r, sector_t dist)
+{
+    double frac = (double)dist / r->capacity;
+    double ms;
+
+    if (dist == 0 || r->model == MODEL_NONE)
+        return 0;
+    if (frac > 1)
+        frac = 1;
+    if (r->model == MODEL_SQRT)
+        frac = sqrt(frac);
+    ms = r->track_ms + (r->full_ms - r->track_ms) * frac;
+    return ms / 1000 + (r->spt ? 0 : 30.0 / r->rpm);
+}
+
+/* Position of the platter at time t, in revolutions */
+static double spin(const struct replay *r, double t)
+{
+    double rev = t * r->rpm / 60;
+
+    return rev - floor(rev);
+}
+
+/* Time until sector comes under the head at time t */
+static double rot_wait(const struct replay *r, double t, sector_t sector)
+{
+    double ang = (double)(sector % r->spt) / r->spt - spin(r, t);
+
+    return (ang < 0 ? ang + 1 : ang) * 60 / r->rpm;
+}
+
+static unsigned long rqs_lower(struct request *const *v, unsigned long n,
+                               sector_t sector)
+{
+    unsigned long lo = 0, hi = n;
+
+    while (lo < hi)
+    {
+        unsigned long mid = (lo + hi) / 2;
+        if (v[mid]->sector < sector)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* First request past sector, c-scan starts there */
+static unsigned long rqs_upper(struct request *const *v, unsigned long n,
+                               sector_t sector)
+{
+    unsigned long lo = 0, hi = n;
+
+    while (lo < hi)
+    {
+        unsigned long mid = (lo + hi) / 2;
+        if (v[mid]->sector <= sector)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Keep v[0..n) sorted by sector, returns where rq went */
+static unsigned long rqs_add(struct request **v, unsigned long *n,
+                             struct request *rq)
+{
+    unsigned long i = rqs_upper(v, *n, rq->sector);
+
+    memmove(&v[i+1], &v[i], (*n - i) * sizeof(*v));
+    v[i] = rq;
+    (*n)++;
+    return i;
+}
+
+/* Where rq is in v[0..n), n when it is not */
+static unsigned long rqs_find(struct request *const *v, unsigned long n,
+                              const struct request *rq)
+{
+    unsigned long i = rqs_lower(v, n, rq->sector);
+
+    while (i < n && v[i] != rq)
+        i++;
+    return i;
+}
+
+static void rqs_del(struct request **v, unsigned long *n, struct request *rq)
+{
+    unsigned long i = rqs_find(v, *n, rq);
+
+    memmove(&v[i], &v[i+1], (*n - i - 1) * sizeof(*v));
+    (*n)--;
+}
+
+static unsigned long sortq_upper(const struct replay *r, sector_t sector)
+{
+    return rqs_upper(r->sortq, r->nsorted, sector);
+}
+
+/* algot_gate(), sortq[i] just came in */
+static void replay_gate(struct replay *r, unsigned long i)
+{
+    struct algot_plan *p = &r->cur;
+    unsigned int s = r->opt_s, e = r->opt_e, a, b;
+    unsigned long lo = i, hi = i;
+
+    if (r->redo || !r->plan_gate)
+        return;
+
+    /* algot_planned() */
+    do
+        lo--;
+    while (lo < i && r->sortq[lo]->idx == ALGOT_IDX_NEW &&
+           i - lo <= (unsigned long)r->dirty);
+    do
+        hi++;
+    while (hi < r->nsorted && r->sortq[hi]->idx == ALGOT_IDX_NEW &&
+           hi - i <= (unsigned long)r->dirty);
+    if (lo > i || hi >= r->nsorted || p->rot.nz || p->stripe.width ||
+        s > e || e >= p->ns || !algot_trim(p, &s, &e))
+    {
+        r->redo = true;
+        return;
+    }
+    a = r->sortq[lo]->idx;
+    b = r->sortq[hi]->idx;
+    if (a < s || a >= b || b > e)
+    {
+        r->redo = true;
+        return;
+    }
+    r->gate_shift += algot_shift(p, s, e, a, b, r->sortq[i]);
+}
+
+static void sortq_add(struct replay *r, struct request *rq)
+{
+    unsigned long i = rqs_add(r->sortq, &r->nsorted, rq);
+
+    r->dirty++;
+    replay_gate(r, i);
+}
+
+static void sortq_del(struct replay *r, struct request *rq)
+{
+    rqs_del(r->sortq, &r->nsorted, rq);
+}
+
+/* Whether anything waits to be moved into sort_queue */
+static bool replay_arrivals(const struct replay *r)
+{
+    return r->waiting < r->arrived || r->nreads;
+}
+
+/* The oldest arrival from the trace or the readers leaves wait_queue */
+static struct request *replay_unwait(struct replay *r)
+{
+    struct request *rq;
+
+    if (r->waiting < r->arrived &&
+        (!r->nreads || r->reqs[r->waiting].queued <= r->reads[0]->queued))
+        return &r->reqs[r->waiting++];
+    rq = r->reads[0];
+    memmove(&r->reads[0], &r->reads[1], --r->nreads * sizeof(*r->reads));
+    return rq;
+}
+
+/*
+ * Move arrivals into sort_queue while there is room, like
+ *  algot_add_request().  By bucket they wait by sector, and the window
+ *  fills from the start of the bucket the head is in, like algot_admit().
+ */
+static void replay_fill(struct replay *r)
+{
+    struct request *rq;
+    unsigned long i;
+
+    if (!r->bucket_sectors)
+    {
+        while (replay_arrivals(r) && r->nsorted < r->sortq_size)
+            sortq_add(r, replay_unwait(r));
+        return;
+    }
+
+    while (replay_arrivals(r))
+        rqs_add(r->waitq, &r->nwaiting, replay_unwait(r));
+    while (r->nwaiting && r->nsorted < r->sortq_size)
+    {
+        i = rqs_lower(r->waitq, r->nwaiting,
+                      r->rw_head / r->bucket_sectors * r->bucket_sectors);
+        rq = r->waitq[i < r->nwaiting ? i : 0];
+        rqs_del(r->waitq, &r->nwaiting, rq);
+        sortq_add(r, rq);
+    }
+}
+
+static void plan_alloc(struct algot_plan *p, unsigned long ms)
+{
+    p->cost_matrix = xmalloc(sizeof(sector_t)*2*mx_half(ms < 2 ? 2 : ms));
+    p->sorted = xmalloc(sizeof(*p->sorted)*ms);
+    p->prev_idx = xmalloc(sizeof(unsigned int)*ms);
+    p->chain = xmalloc(sizeof(unsigned int)*ms);
+    p->pos = xmalloc(sizeof(sector_t)*ms);
+    p->adj = xmalloc(sizeof(sector_t)*ms);
+    p->xfer = xmalloc(sizeof(sector_t)*ms);
+    p->wsum = xmalloc(sizeof(u32)*(ms+1));
+    p->ang = xmalloc(sizeof(u32)*ms);
+    p->ns = 0;
+    p->narrow = false;
+    p->greedy = false;
+    p->rt_weight = 1;
+}
+
+/* algot_width() */
+static unsigned long replay_width(struct replay *r, unsigned long ns)
+{
+    unsigned long width;
+
+    if (ns <= r->greedy_max || r->rot.nz || !r->budget)
+        return ns;
+    width = algot_budget_width((u64)r->budget * 1000, r->cell_cost);
+    if (width < REPLAY_CALC_MIN)
+        width = REPLAY_CALC_MIN;
+    if (width >= ns)
+        return ns;
+    r->bounded++;
+    return width;
+}
+
+/* algot_program(): lay out, solve and install a plan over sort_queue */
+static void algot_replay_program(struct replay *r)
+{
+    struct algot_plan *p = &r->next, tmp;
+    unsigned long start, fwd, bwd, k, cells;
+    struct timespec t, a, b;
+    struct request *rq;
+    sector_t saved;
+    bool worth;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    replay_fill(r);
+
+    /* The nearest requests ahead of the head or behind it */
+    p->ns = replay_width(r, r->nsorted);
+    p->greedy = p->ns <= r->greedy_max;
+    start = sortq_upper(r, r->rw_head);
+    fwd = start;
+    bwd = start;
+    for (k = 0; k < p->ns; k++)
+    {
+        if (fwd < r->nsorted && (!bwd || r->sortq[fwd]->sector - r->rw_head <=
+                                         r->rw_head - r->sortq[bwd-1]->sector))
+            fwd++;
+        else
+            bwd--;
+    }
+    for (k = 0; k < p->ns; k++)
+        p->sorted[k] = r->sortq[k < fwd - start ? start + k :
+                                                  bwd + k - (fwd - start)];
+    p->stripe.chunk = r->volume.chunk;
+    p->stripe.width = r->stripe_aware && r->volume.width > 1 ?
+                      r->volume.width : 0;
+    algot_stripe_order(p, r->rw_head);
+    for (k = 0; k < p->ns; k++)
+    {
+        rq = p->sorted[k];
+        algot_link(p, k, rq, r->incremental ? rq->idx : ALGOT_IDX_NEW);
+    }
+    p->model = r->costs;
+    p->rot = r->rot;
+    p->xfer_cost = r->xfer_cost;
+    p->size_weight = r->size_weight;
+    p->rt_weight = 1;
+    algot_lay_out(p, r->narrow_matrix);
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    cells = algot_solve(p, &r->cur);
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    r->cell_cost = algot_cell_cost(r->cell_cost, cells,
+                                   (b.tv_sec - a.tv_sec) * 1000000000ull +
+                                   b.tv_nsec - a.tv_nsec);
+
+    /* algot_adapt() */
+    if (r->adapt_dirty &&
+        algot_saving(&r->cur, r->opt_s, r->opt_e, p, r->rw_head, &saved))
+    {
+        if (p->model.n)
+            worth = saved > ((b.tv_sec - t.tv_sec) * 1000000000ull +
+                             b.tv_nsec - t.tv_nsec) / 1000;
+        else
+            worth = saved > 0;
+        if (worth)
+            r->dirty_limit = r->dirty_limit > 1 ? r->dirty_limit / 2 : 1;
+        else
+        {
+            if (r->dirty_limit < (int)r->calc_max)
+                r->dirty_limit++;
+            r->futile++;
+        }
+    }
+
+    for (k = r->opt_s; k <= r->opt_e && k < r->cur.ns; k++)
+    {
+        if (r->cur.sorted[k] != ALGOT_REF_MERGED)
+            r->cur.sorted[k]->idx = ALGOT_IDX_NEW;
+    }
+    for (k = 0; k < p->ns; k++)
+        p->sorted[k]->idx = k;
+    tmp = r->cur;
+    r->cur = r->next;
+    r->next = tmp;
+    r->opt_s = 0;
+    r->opt_e = r->cur.ns - 1;
+    if (!r->cur.ns)
+        r->opt_s = 1;
+    r->dirty = 0;
+    r->redo = false;
+    r->gate_shift = 0;
+    r->programs++;
+}
+
+/* algot_passing(), rq leaves sort_queue */
+static void replay_passing(struct replay *r, struct request *rq)
+{
+    unsigned long k = rqs_find(r->sortq, r->nsorted, rq);
+
+    if ((k && r->sortq[k-1]->idx == ALGOT_IDX_NEW) ||
+        (k+1 < r->nsorted && r->sortq[k+1]->idx == ALGOT_IDX_NEW))
+        r->redo = true;
+    sortq_del(r, rq);
+}
+
+/* pick_opt() */
+static struct request *algot_replay_pick(struct replay *r)
+{
+    struct algot_plan *p = &r->cur;
+    unsigned int s = r->opt_s, e = r->opt_e, i;
+    struct request *rq;
+
+    if (!algot_trim(p, &s, &e))
+    {
+        r->opt_s = s;
+        return NULL;
+    }
+    if (p->rot.nz)
+    {
+        /* replay_run() dispatches once the last request is done */
+        i = algot_satf(p, s, e, r->rw_end, spin(r, r->now) * p->rot.rev);
+        if (i == s)
+            s++;
+        else if (i == e)
+            e--;
+    }
+    else if (s == e || algot_side(p, s, e, r->rw_head))
+        i = s++;
+    else
+        i = e--;
+    r->opt_s = s;
+    r->opt_e = e;
+
+    rq = p->sorted[i];
+    p->sorted[i] = i < s || i > e ? ALGOT_REF_DISPATCHED : ALGOT_REF_MERGED;
+    rq->idx = ALGOT_IDX_NEW;
+    replay_passing(r, rq);
+    return rq;
+}
+
+/*
+ * The read waited for goes ahead of the plan, from wherever it is, like
+ *  algot_pick() takes antic_rq
+ */
+static void replay_take(struct replay *r, struct request *rq)
+{
+    unsigned int i;
+
+    for (i = 0; i < r->nreads; i++)
+    {
+        if (r->reads[i] == rq)
+        {
+            memmove(&r->reads[i], &r->reads[i+1],
+                    (--r->nreads - i) * sizeof(*r->reads));
+            return;
+        }
+    }
+    if (rqs_find(r->waitq, r->nwaiting, rq) < r->nwaiting)
+    {
+        rqs_del(r->waitq, &r->nwaiting, rq);
+        return;
+    }
+    if (rq->idx != ALGOT_IDX_NEW)
+    {
+        r->cur.sorted[rq->idx] = ALGOT_REF_MERGED;
+        rq->idx = ALGOT_IDX_NEW;
+    }
+    replay_passing(r, rq);
+}
+
+/* algot_stale() */
+static bool replay_stale(struct replay *r)
+{
+    struct algot_plan *p = &r->cur;
+    unsigned int s = r->opt_s, e = r->opt_e;
+    sector_t left, right;
+
+    if (r->dirty < r->dirty_limit)
+        return false;
+    if (r->redo || !r->plan_gate || s > e || e >= p->ns ||
+        !algot_trim(p, &s, &e) || s == e ||
+        (unsigned int)r->dirty * REPLAY_HOLE_SHARE > e - s + 1)
+        return true;
+
+    left = algot_first(p, s, e, r->rw_head, true);
+    right = algot_first(p, s, e, r->rw_head, false);
+    if ((left > right ? left - right : right - left) <= r->gate_shift)
+        return true;
+    r->gated++;
+    return false;
+}
+
+static struct request *algot_replay_dispatch(struct replay *r)
+{
+    struct request *rq;
+
+    if (r->antic_rq && r->antic_run < REPLAY_ANTIC_RUN)
+    {
+        rq = r->antic_rq;
+        replay_take(r, rq);
+        return rq;
+    }
+    if (r->antic && !r->antic_rq)
+    {
+        if (r->now < r->antic_until)
+            return NULL;
+        r->antic = NULL;
+        r->antic_misses++;
+    }
+
+    if (replay_stale(r))
+        algot_replay_program(r);
+    rq = algot_replay_pick(r);
+    if (!rq)
+    {
+        algot_replay_program(r);
+        rq = algot_replay_pick(r);
+    }
+    return rq;
+}
+
+static struct request *cscan_dispatch(struct replay *r)
+{
+    unsigned long i;
+    struct request *rq;
+
+    replay_fill(r);
+    i = sortq_upper(r, r->rw_head);
+    rq = r->sortq[i < r->nsorted ? i : 0];
+    sortq_del(r, rq);
+    return rq;
+}
+
+static struct request *replay_dispatch(struct replay *r)
+{
+    struct request *rq;
+
+    switch (r->sched)
+    {
+    case SCHED_ALGOT:
+        rq = algot_replay_dispatch(r);
+        break;
+    case SCHED_CSCAN:
+        rq = cscan_dispatch(r);
+        break;
+    default:
+        return replay_unwait(r);
+    }
+    if (!rq)
+        return NULL;
+    r->rw_head = rq->sector;
+    r->rw_end = rq->sector + rq->nr_sectors;
+    return rq;
+}
+
+static void replay_add(struct replay *r)
+{
+    r->arrived++;
+    if (r->sched != SCHED_FIFO)
+        replay_fill(r);
+}
+
+static bool replay_queued(const struct replay *r)
+{
+    return r->nsorted || r->nwaiting || replay_arrivals(r);
+}
+
+/* When the next request arrives, from the trace or a reader */
+static double replay_next(const struct replay *r)
+{
+    double t = r->arrived < r->n ? r->reqs[r->arrived].queued : INFINITY;
+    unsigned int i;
+
+    for (i = 0; i < r->nstreams; i++)
+    {
+        if (r->streams[i].pending && r->streams[i].due < t)
+            t = r->streams[i].due;
+    }
+    return t;
+}
+
+/* Readers whose think time is up read on, like algot_add_request() */
+static void replay_read(struct replay *r, double t)
+{
+    struct replay_stream *s;
+    unsigned int i;
+
+    for (i = 0; i < r->nstreams; i++)
+    {
+        s = &r->streams[i];
+        if (!s->pending || s->due > t)
+            continue;
+        s->pending = false;
+        s->rq.queued = s->due;
+        algot_stream_read(&s->st, s->rq.sector, s->rq.nr_sectors,
+                          s->done * 1e9, s->due * 1e9);
+        r->reads[r->nreads++] = &s->rq;
+        if (s == r->antic && !r->antic_rq)
+        {
+            r->antic_rq = &s->rq;
+            r->antic_hits++;
+        }
+        if (r->sched != SCHED_FIFO)
+            replay_fill(r);
+    }
+}
+
+/*
+ * rq went out and is done at rq->done, like algot_take(): a reader thinks
+ *  until its next read, and when it reads on within antic_expire
+ *  dispatch holds off for that until antic_expire after rq is done,
+ *  REPLAY_ANTIC_RUN reads in a row at most.
+ */
+static void replay_taken(struct replay *r, struct request *rq)
+{
+    struct replay_stream *s = rq->stream < 0 ? NULL : &r->streams[rq->stream];
+
+    if (!r->antic || rq == r->antic_rq)
+    {
+        r->antic_run = rq == r->antic_rq ? r->antic_run + 1 : 0;
+        r->antic = NULL;
+        r->antic_rq = NULL;
+    }
+    if (!s)
+        return;
+
+    s->st.queued--;
+    s->reads++;
+    s->done = rq->done;
+    s->due = rq->done + r->think;
+    s->pending = true;
+    s->rq.sector += s->rq.nr_sectors;
+    if (s->rq.sector + s->rq.nr_sectors > r->capacity)
+        s->rq.sector = 0;
+    if (r->sched == SCHED_ALGOT && !r->antic &&
+        r->antic_run < REPLAY_ANTIC_RUN &&
+        algot_stream_on(&s->st, r->antic_expire))
+    {
+        r->antic = s;
+        r->antic_until = rq->done + r->antic_expire / 1e6;
+        r->antic_waits++;
+    }
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char *what, double *v, unsigned long n)
+{
+    double sum = 0;
+    unsigned long i;
+
+    for (i = 0; i < n; i++)
+        sum += v[i];
+    qsort(v, n, sizeof(*v), cmp_double);
+    printf("%-10s mean %.3f ms  p99 %.3f ms  p99.9 %.3f ms  max %.3f ms\n",
+           what, sum / n * 1000, v[n*99/100] * 1000, v[n*999/1000] * 1000,
+           v[n-1] * 1000);
+}
+
+/*
+ * How much of [sector, end) lies in the chunk of sector, the member that
+ *  holds it and the depth it starts at there.  Without a volume, all of
+ *  it is on the one disk.
+ */
+static sector_t replay_piece(const struct replay *r, sector_t sector,
+                             sector_t end, unsigned int *member, sector_t *depth)
+{
+    sector_t next;
+
+    *member = 0;
+    *depth = sector;
+    if (!r->volume.width)
+        return end - sector;
+    *member = sector / r->volume.chunk % r->volume.width;
+    *depth = algot_member_pos(&r->volume, sector);
+    next = (sector / r->volume.chunk + 1) * r->volume.chunk;
+    return (next < end ? next : end) - sector;
+}
+
+static void replay_run(struct replay *r)
+{
+    unsigned int members = r->volume.width ? r->volume.width : 1, m;
+    sector_t *head = calloc(members, sizeof(*head));
+    double *idle = calloc(members, sizeof(*idle));
+    double *flight = calloc(members, sizeof(*flight));
+    unsigned int inflight = 0, k;
+    sector_t pos, dist, sect, len, seek = 0;
+    double t = 0, at, cpu, cpu_max = 0, cpu_sum = 0;
+    double *wait = xmalloc(sizeof(double)*r->n);
+    double *resp = xmalloc(sizeof(double)*r->n);
+    struct timespec a, b;
+    struct request *rq;
+    unsigned long done, dispatched = 0, reads = 0;
+
+    if (!head || !idle || !flight)
+    {
+        perror("calloc");
+        exit(1);
+    }
+
+    for (done = 0; done < r->n; )
+    {
+        if (!replay_queued(r) && t < replay_next(r))
+            t = replay_next(r);
+        while (r->arrived < r->n && r->reqs[r->arrived].queued <= t)
+            replay_add(r);
+        replay_read(r, t);
+
+        r->now = t;
+        clock_gettime(CLOCK_MONOTONIC, &a);
+        rq = replay_dispatch(r);
+        clock_gettime(CLOCK_MONOTONIC, &b);
+        cpu = (b.tv_sec - a.tv_sec) * 1e9 + (b.tv_nsec - a.tv_nsec);
+        cpu_sum += cpu;
+        if (cpu > cpu_max)
+            cpu_max = cpu;
+        dispatched++;
+
+        /* Held off for a reader, until its read comes or the wait is over */
+        if (!rq)
+        {
+            t = r->antic->pending && r->antic->due < r->antic_until ?
+                r->antic->due : r->antic_until;
+            continue;
+        }
+
+        /*
+         * On a volume, each member serves its chunks of the request once
+         *  done with what it had before, and the request completes with
+         *  the last of them.  The volume takes as many requests as it has
+         *  members, the next goes out once one of them completes.
+         */
+        rq->started = t;
+        rq->done = t;
+        for (sect = rq->sector; sect < rq->sector + rq->nr_sectors; sect += len)
+        {
+            len = replay_piece(r, sect, rq->sector + rq->nr_sectors, &m, &pos);
+            dist = algot_dist(head[m], pos);
+            seek += dist;
+            at = t > idle[m] ? t : idle[m];
+            at += seek_time(r, dist);
+            if (r->spt)
+                at += rot_wait(r, at, pos);
+            at += len / r->rate;
+            idle[m] = at;
+            head[m] = pos + len;
+            rq->done = at > rq->done ? at : rq->done;
+        }
+        flight[inflight++] = rq->done;
+        while (inflight)
+        {
+            for (k = 0, m = 1; m < inflight; m++)
+                k = flight[m] < flight[k] ? m : k;
+            if (inflight == members && flight[k] > t)
+                t = flight[k];
+            if (flight[k] > t)
+                break;
+            flight[k] = flight[--inflight];
+        }
+
+        replay_taken(r, rq);
+        if (rq->stream >= 0)
+        {
+            reads++;
+            continue;
+        }
+        wait[done] = rq->started - rq->queued;
+        resp[done] = rq->done - rq->queued;
+        done++;
+    }
+
+    for (m = 0; m < members; m++)
+        t = idle[m] > t ? idle[m] : t;
+    printf("requests   %lu in %.3f s\n", r->n, t - r->reqs[0].queued);
+    printf("seek       %llu sectors, %.1f per request\n",
+           (unsigned long long)seek, (double)seek / r->n);
+    report("wait", wait, r->n);
+    report("response", resp, r->n);
+    if (r->nstreams)
+        printf("streams    %u readers, %lu reads, %.1f MB/s, antic %lu, "
+               "%lu hits, %lu misses\n", r->nstreams, reads,
+               reads * REPLAY_STREAM_SECTORS * 512.0 / 1e6 /
+               (t - r->reqs[0].queued), r->antic_waits, r->antic_hits,
+               r->antic_misses);
+    printf("cpu        %.0f ns per dispatch, max %.0f ns\n",
+           cpu_sum / dispatched, cpu_max);
+    if (r->sched == SCHED_ALGOT)
+        printf("programs   %lu, %lu bounded, %lu futile, %lu gated, avx2 %s\n",
+               r->programs, r->bounded, r->futile, r->gated,
+#ifdef CONFIG_X86_64
+               algot_has_avx2 ? "on" : "off");
+#else
+               "n/a");
+#endif
+    free(head);
+    free(idle);
+    free(flight);
+    free(wait);
+    free(resp);
+}
+
+static int cmp_queued(const void *a, const void *b)
+{
+    const struct request *x = a, *y = b;
+
+    return x->queued < y->queued ? -1 : x->queued > y->queued;
+}
+
+/*
+ * Requests from blkparse's default output, e.g.
+ *   8,0    3        1     0.000000000  1234  Q   R 123456 + 8 [proc]
+ *  keeping only events of the given action.
+ */
+static void load_blkparse(struct replay *r, FILE *f, char action)
+{
+    unsigned long size = 1024;
+    char line[512], act[4], rwbs[16];
+    unsigned long long sector;
+    unsigned int nr, maj, min, cpu, seq, pid;
+    double time;
+
+    r->reqs = xmalloc(sizeof(*r->reqs)*size);
+    while (fgets(line, sizeof(line), f))
+    {
+        if (sscanf(line, "%u,%u %u %u %lf %u %3s %15s %llu + %u",
+                   &maj, &min, &cpu, &seq, &time, &pid, act, rwbs,
+                   &sector, &nr) != 10)
+            continue;
+        if (act[0] != action || act[1] || !nr ||
+            (!strchr(rwbs, 'R') && !strchr(rwbs, 'W')))
+            continue;
+        if (r->n == size)
+        {
+            size *= 2;
+            r->reqs = realloc(r->reqs, sizeof(*r->reqs)*size);
+            if (!r->reqs)
+            {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        r->reqs[r->n].sector = sector;
+        r->reqs[r->n].nr_sectors = nr;
+        r->reqs[r->n].write = strchr(rwbs, 'W');
+        r->reqs[r->n].queued = time;
+        r->n++;
+    }
+    /* Events from different CPUs may be slightly out of order */
+    qsort(r->reqs, r->n, sizeof(*r->reqs), cmp_queued);
+}
+
+/*
+ * Poisson arrivals, a third of them close to the previous request and the
+ *  rest anywhere on a 1TB disk.
+ */
+static void load_synthetic(struct replay *r, unsigned long n, double iat)
+{
+    sector_t disk = 2ULL << 30, last = 0;
+    double t = 0;
+    unsigned long i;
+
+    srand48(1);
+    r->reqs = xmalloc(sizeof(*r->reqs)*n);
+    for (i = 0; i < n; i++)
+    {
+        t += -log(1 - drand48()) * iat;
+        if (drand48() < 1.0/3)
+            last = (last + (sector_t)(drand48() * 4096)) % disk;
+        else
+            last = (sector_t)(drand48() * disk);
+        r->reqs[i].sector = last;
+        r->reqs[i].nr_sectors = 8 << (lrand48() % 4);
+        r->reqs[i].write = drand48() < 0.3;
+        r->reqs[i].queued = t;
+    }
+    r->n = n;
+}
+
+/* Parse "distance:cost" points the way the seek_model sysfs file does */
+static bool parse_costs(struct algot_model *m, const char *s)
+{
+    unsigned long long dist, cost;
+    unsigned int n = 0;
+    int len;
+
+    while (sscanf(s, " %llu:%llu%n", &dist, &cost, &len) == 2)
+    {
+        if (n == ALGOT_MODEL_POINTS)
+            return false;
+        m->dist[n] = dist;
+        m->cost[n++] = cost;
+        s += len;
+    }
+    while (*s == ' ' || *s == '\n')
+        s++;
+    return !*s && algot_model_set(m, n);
+}
+
+/*
+ * Calibrate algot to the modelled disk: seek times in us at distances
+ *  doubling up to the capacity, what measuring a real device would give,
+ *  its transfer rate unless -X says otherwise, and its tracks when it has
+ *  some.
+ */
+static void calibrate_costs(struct replay *r)
+{
+    struct algot_model *m = &r->costs;
+    sector_t dist = r->capacity;
+    int i, n = ALGOT_MODEL_POINTS;
+
+    for (i = n-1; i >= 0; i--)
+    {
+        m->dist[i] = dist ? dist : 1;
+        dist /= 2;
+    }
+    for (i = 1; i < n; i++)
+    {
+        if (m->dist[i] <= m->dist[i-1])
+            m->dist[i] = m->dist[i-1] + 1;
+    }
+    for (i = 0; i < n; i++)
+        m->cost[i] = seek_time(r, m->dist[i]) * 1e6;
+    algot_model_set(m, n);
+    if (!r->xfer_cost)
+        r->xfer_cost = 2048 / r->rate * 1e6;
+
+    if (!r->spt)
+        return;
+    r->rot.rev = 60e6 / r->rpm;
+    r->rot.start[0] = 0;
+    r->rot.spt[0] = r->spt;
+    algot_rotation_set(&r->rot, 1);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "usage: %s [options] [blkparse-output]\n"
+        "  -s algot|cscan|fifo  scheduler (algot)\n"
+        "  -m sqrt|linear|none  seek model (sqrt)\n"
+        "  -c calc_max          calculation window (%d)\n"
+        "  -d dirty_count       dirty threshold (%d)\n"
+        "  -A                   keep the dirty threshold fixed, as adapt_dirty 0\n"
+        "  -P                   recalculate dirty plans regardless, as plan_gate 0\n"
+        "  -I                   disable incremental rebuilds\n"
+        "  -N                   disable narrow matrices\n"
+        "  -V                   disable the vectorised sweep\n"
+        "  -M dist:cost ...     algot seek costs, as in seek_model (distance)\n"
+        "  -X us                algot cost of transferring 1 MiB, as in transfer_cost (0)\n"
+        "  -W sectors           algot size weight, as in size_weight (0)\n"
+        "  -L sectors           algot window filled by bucket, as in bucket_sectors (0)\n"
+        "  -S chunk:members     stripe the disk over members of the disk model,\n"
+        "                       chunk sectors at a time, each serving its own\n"
+        "  -Y                   algot orders plans by depth on the members of -S,\n"
+        "                       as stripe_aware 1\n"
+        "  -G n                 algot widest plan without a matrix, as in greedy_max (%d)\n"
+        "  -B us                algot calculation budget, as in program_budget (%d)\n"
+        "  -K                   calibrate the algot costs to the disk model\n"
+        "  -D sectors           disk capacity (highest sector of the trace)\n"
+        "  -T ms                track to track seek (0.8)\n"
+        "  -F ms                full stroke seek (16)\n"
+        "  -r rpm               spindle speed (7200)\n"
+        "  -R sectors           sectors per track, waits for the sector under the\n"
+        "                       head instead of half a revolution, and sets the\n"
+        "                       transfer rate\n"
+        "  -t MB/s              media transfer rate (100)\n"
+        "  -a action            blkparse action to replay (Q)\n"
+        "  -g n                 generate n requests instead of reading a trace\n"
+        "  -i ms                mean inter-arrival time of -g (5)\n"
+        "  -q readers:us        add readers each reading on sequentially, one\n"
+        "                       read at a time, us after the last completed\n"
+        "  -E us                algot waits for a reader to read on, as in\n"
+        "                       antic_expire (0)\n",
+        prog, REPLAY_CALC_MAX, REPLAY_DIRTY_COUNT, REPLAY_GREEDY_MAX,
+        REPLAY_BUDGET);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    struct replay r = {
+        .sched = SCHED_ALGOT,
+        .model = MODEL_SQRT,
+        .calc_max = REPLAY_CALC_MAX,
+        .dirty_count = REPLAY_DIRTY_COUNT,
+        .adapt_dirty = true,
+        .plan_gate = true,
+        .greedy_max = REPLAY_GREEDY_MAX,
+        .budget = REPLAY_BUDGET,
+        .cell_cost = 2 << 8,
+        .incremental = true,
+        .narrow_matrix = true,
+        .track_ms = 0.8,
+        .full_ms = 16,
+        .rpm = 7200,
+        .rate = 100e6 / 512,
+    };
+    unsigned long gen = 0;
+    double iat = 0.005, think = 0;
+    bool simd = true;
+    bool calibrate = false;
+    char action = 'Q';
+    FILE *f = stdin;
+    unsigned long i;
+    sector_t end;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:m:c:d:APINVM:X:W:L:S:YG:B:KD:T:F:r:R:t:a:g:i:q:E:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            if (!strcmp(optarg, "algot"))
+                r.sched = SCHED_ALGOT;
+            else if (!strcmp(optarg, "cscan"))
+                r.sched = SCHED_CSCAN;
+            else if (!strcmp(optarg, "fifo"))
+                r.sched = SCHED_FIFO;
+            else
+                usage(argv[0]);
+            break;
+        case 'm':
+            if (!strcmp(optarg, "sqrt"))
+                r.model = MODEL_SQRT;
+            else if (!strcmp(optarg, "linear"))
+                r.model = MODEL_LINEAR;
+            else if (!strcmp(optarg, "none"))
+                r.model = MODEL_NONE;
+            else
+                usage(argv[0]);
+            break;
+        case 'c':
+            r.calc_max = atoi(optarg);
+            break;
+        case 'd':
+            r.dirty_count = atoi(optarg);
+            break;
+        case 'A':
+            r.adapt_dirty = false;
+            break;
+        case 'P':
+            r.plan_gate = false;
+            break;
+        case 'I':
+            r.incremental = false;
+            break;
+        case 'N':
+            r.narrow_matrix = false;
+            break;
+        case 'V':
+            simd = false;
+            break;
+        case 'M':
+            if (!parse_costs(&r.costs, optarg))
+                usage(argv[0]);
+            break;
+        case 'X':
+            r.xfer_cost = atoi(optarg);
+            break;
+        case 'W':
+            r.size_weight = atoi(optarg);
+            break;
+        case 'L':
+            r.bucket_sectors = strtoull(optarg, NULL, 10);
+            break;
+        case 'S':
+            if (sscanf(optarg, "%u:%u", &r.volume.chunk, &r.volume.width) != 2 ||
+                !r.volume.chunk || !r.volume.width)
+                usage(argv[0]);
+            break;
+        case 'Y':
+            r.stripe_aware = true;
+            break;
+        case 'G':
+            r.greedy_max = atoi(optarg);
+            break;
+        case 'B':
+            r.budget = atoi(optarg);
+            break;
+        case 'K':
+            calibrate = true;
+            break;
+        case 'D':
+            r.capacity = strtoull(optarg, NULL, 10);
+            break;
+        case 'T':
+            r.track_ms = atof(optarg);
+            break;
+        case 'F':
+            r.full_ms = atof(optarg);
+            break;
+        case 'r':
+            r.rpm = atof(optarg);
+            break;
+        case 'R':
+            r.spt = atoi(optarg);
+            break;
+        case 't':
+            r.rate = atof(optarg) * 1e6 / 512;
+            break;
+        case 'a':
+            action = optarg[0];
+            break;
+        case 'g':
+            gen = strtoul(optarg, NULL, 10);
+            break;
+        case 'i':
+            iat = atof(optarg) / 1000;
+            break;
+        case 'q':
+            if (sscanf(optarg, "%u:%lf", &r.nstreams, &think) != 2 || think < 0)
+                usage(argv[0]);
+            r.think = think / 1e6;
+            break;
+        case 'E':
+            r.antic_expire = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (r.calc_max < 1 || r.dirty_count < 1 || r.full_ms < r.track_ms ||
+        r.rpm <= 0 || r.rate <= 0)
+        usage(argv[0]);
+    if (r.spt)
+        r.rate = r.spt * r.rpm / 60;
+
+#ifdef CONFIG_X86_64
+    algot_has_avx2 = simd && __builtin_cpu_supports("avx2");
+#else
+    (void)simd;
+#endif
+
+    if (gen)
+        load_synthetic(&r, gen, iat);
+    else
+    {
+        if (optind < argc && !(f = fopen(argv[optind], "r")))
+        {
+            perror(argv[optind]);
+            return 1;
+        }
+        load_blkparse(&r, f, action);
+    }
+    if (!r.n)
+    {
+        fprintf(stderr, "no requests to replay\n");
+        return 1;
+    }
+
+    /*
+     * cscan sorts everything queued, algot only its window.  Each reader
+     *  has one read queued at most, on top of the trace.
+     */
+    r.sortq_size = r.sched == SCHED_ALGOT ? r.calc_max : r.n + r.nstreams;
+    r.sortq = xmalloc(sizeof(*r.sortq)*r.sortq_size);
+    if (r.sched != SCHED_ALGOT)
+        r.bucket_sectors = 0;
+    if (r.bucket_sectors)
+        r.waitq = xmalloc(sizeof(*r.waitq)*(r.n + r.nstreams));
+    if (r.sched == SCHED_ALGOT)
+    {
+        plan_alloc(&r.cur, r.calc_max);
+        plan_alloc(&r.next, r.calc_max);
+        r.opt_s = 1;
+        r.dirty_limit = r.dirty_count;
+        r.redo = true;
+        r.dirty = r.dirty_count - 1;
+    }
+    /* Seeks are within a member, what the disk model covers is one */
+    for (i = 0; i < r.n; i++)
+    {
+        r.reqs[i].idx = ALGOT_IDX_NEW;
+        r.reqs[i].stream = -1;
+        end = algot_member_pos(&r.volume, r.reqs[i].sector) +
+              r.reqs[i].nr_sectors;
+        if (end > r.capacity)
+            r.capacity = end;
+    }
+
+    if (calibrate)
+        calibrate_costs(&r);
+
+    /* Readers start spread over the disk, with the trace */
+    r.streams = calloc(r.nstreams, sizeof(*r.streams));
+    r.reads = xmalloc(sizeof(*r.reads)*(r.nstreams + 1));
+    if (!r.streams)
+    {
+        perror("calloc");
+        exit(1);
+    }
+    for (i = 0; i < r.nstreams; i++)
+    {
+        r.streams[i].rq.sector = r.capacity / (r.nstreams + 1) * (i + 1);
+        r.streams[i].rq.nr_sectors = REPLAY_STREAM_SECTORS;
+        r.streams[i].rq.idx = ALGOT_IDX_NEW;
+        r.streams[i].rq.stream = i;
+        r.streams[i].due = r.reqs[0].queued;
+        r.streams[i].pending = true;
+    }
+
+    replay_run(&r);
+    return 0;
+}
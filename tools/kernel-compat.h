@@ -0,0 +1,131 @@
+/*
+ * The kernel types and primitives algot-core.h relies on, so the core
+ *  builds in userspace.  Define struct request, blk_rq_pos(),
+ *  blk_rq_sectors() and req_get_ioprio() before including the core.
+ */
+#ifndef _ALGOT_KERNEL_COMPAT_H
+#define _ALGOT_KERNEL_COMPAT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef u64 sector_t;
+
+#define U32_MAX  UINT32_MAX
+#define U64_MAX  UINT64_MAX
+
+#define NSEC_PER_USEC  1000ULL
+
+#define IOPRIO_CLASS_RT  1
+#define IOPRIO_PRIO_CLASS(ioprio)  (((ioprio) >> 13) & 7)
+
+#ifndef __always_inline
+#define __always_inline  inline __attribute__((__always_inline__))
+#endif
+#define __read_mostly
+
+#define min(a, b)  ({ typeof(a) _a = (a); typeof(b) _b = (b); _a < _b ? _a : _b; })
+#define min_t(type, a, b)  min((type)(a), (type)(b))
+
+static inline u64 div64_u64(u64 dividend, u64 divisor)
+{
+    return dividend / divisor;
+}
+
+static inline u64 div_u64_rem(u64 dividend, u32 divisor, u32 *remainder)
+{
+    *remainder = dividend % divisor;
+    return dividend / divisor;
+}
+
+static inline u64 div_u64(u64 dividend, u32 divisor)
+{
+    return dividend / divisor;
+}
+
+static inline int ilog2(u64 n)
+{
+    return 63 - __builtin_clzll(n);
+}
+
+static inline u32 int_sqrt64(u64 x)
+{
+    u64 r = sqrtl(x);
+
+    while (r * r > x)
+        r--;
+    while ((r + 1) * (r + 1) <= x)
+        r++;
+    return r;
+}
+
+static inline u64 mul_u64_u64_shr(u64 a, u64 mul, unsigned int shift)
+{
+    return (u64)(((unsigned __int128)a * mul) >> shift);
+}
+
+typedef int (*cmp_r_func_t)(const void *a, const void *b, const void *priv);
+
+static inline void sort_swap(char *a, char *b, size_t size)
+{
+    char t;
+
+    while (size--)
+    {
+        t = *a;
+        *a++ = *b;
+        *b++ = t;
+    }
+}
+
+/* Heapsort like the kernel's, which needs no swap function given either */
+static inline void sort_r(void *base, size_t num, size_t size,
+                          cmp_r_func_t cmp, void *swap, const void *priv)
+{
+    char *b = base;
+    size_t n = num, i = num / 2, root, child;
+
+    (void)swap;
+    while (n > 1)
+    {
+        if (i)
+            i--;
+        else
+            sort_swap(b, b + --n*size, size);
+        for (root = i; (child = 2*root + 1) < n; root = child)
+        {
+            if (child + 1 < n &&
+                cmp(b + child*size, b + (child+1)*size, priv) < 0)
+                child++;
+            if (cmp(b + root*size, b + child*size, priv) >= 0)
+                break;
+            sort_swap(b + root*size, b + child*size, size);
+        }
+    }
+}
+
+#ifdef __x86_64__
+#define CONFIG_X86_64
+
+/* A process owns its vector registers, no state to save */
+static inline bool may_use_simd(void)
+{
+    return true;
+}
+
+static inline void kernel_fpu_begin(void)
+{
+}
+
+static inline void kernel_fpu_end(void)
+{
+}
+#endif
+
+#endif /* _ALGOT_KERNEL_COMPAT_H */